@@ -0,0 +1,171 @@
+#pragma once
+#include "TaskSystem/TaskSystem.h"
+#include "Codebase/Codebase.h"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <gsl/span>
+#include <type_traits>
+
+namespace sakura::task_system::ecs
+{
+	template<class P>
+	struct param_component;
+	template<template<class> class P, class T>
+	struct param_component<P<T>> { using type = T; };
+
+	// Compile-time access analysis of parameter lists (hana tuples of param<T> and
+	// param<const T>). Component ids are only known at runtime, so masks are built
+	// over the component types of the lists being compared.
+	namespace access
+	{
+		template<class P>
+		using component_t = std::remove_const_t<typename param_component<P>::type>;
+		template<class P>
+		constexpr bool is_read = std::is_const_v<typename param_component<P>::type>;
+
+		template<class... Ts>
+		struct type_list {};
+
+		template<class List, class T>
+		struct append_unique;
+		template<class... Ts, class T>
+		struct append_unique<type_list<Ts...>, T>
+		{
+			using type = std::conditional_t<(std::is_same_v<Ts, T> || ...), type_list<Ts...>, type_list<Ts..., T>>;
+		};
+
+		template<class List, class... Ts>
+		struct unique { using type = List; };
+		template<class List, class T, class... Ts>
+		struct unique<List, T, Ts...> : unique<typename append_unique<List, T>::type, Ts...> {};
+
+		template<class... Ts>
+		constexpr size_t length(type_list<Ts...>) { return sizeof...(Ts); }
+
+		template<class T, class... Ts>
+		constexpr size_t index_in(type_list<Ts...>)
+		{
+			size_t index = 0;
+			const bool found = ((std::is_same_v<T, Ts> ? true : (++index, false)) || ...);
+			return found ? index : sizeof...(Ts);
+		}
+
+		template<class Params>
+		struct list_impl { static constexpr bool aliased = false; };
+		template<class... Ps>
+		struct list_impl<boost::hana::tuple<Ps...>>
+		{
+			using components = typename unique<type_list<>, component_t<Ps>...>::type;
+			// Some component is passed twice, as two reads, two writes or a read aliasing a write.
+			static constexpr bool aliased = sizeof...(Ps) != length(components{});
+			// Bits of the read and written components, indexed in Universe.
+			template<class Universe>
+			static constexpr uint64_t read_mask() { return ((is_read<Ps> ? 1ull << index_in<component_t<Ps>>(Universe{}) : 0ull) | ... | 0ull); }
+			template<class Universe>
+			static constexpr uint64_t write_mask() { return ((is_read<Ps> ? 0ull : 1ull << index_in<component_t<Ps>>(Universe{})) | ... | 0ull); }
+		};
+		// Accesses of one parameter list, cv-qualifiers of the tuple type are ignored.
+		template<class Params>
+		using list = list_impl<std::remove_cv_t<Params>>;
+
+		template<class List, class Params>
+		struct merge;
+		template<class... Ts, class... Cs>
+		struct merge<type_list<Ts...>, type_list<Cs...>> : unique<type_list<Ts...>, Cs...> {};
+
+		template<class List, class... Params>
+		struct all_components { using type = List; };
+		template<class List, class Params, class... Rest>
+		struct all_components<List, Params, Rest...>
+			: all_components<typename merge<List, typename list<Params>::components>::type, Rest...> {};
+	}
+
+	// True if the two parameter lists can not run concurrently on shared chunks:
+	// one writes a component the other reads or writes.
+	template<class A, class B>
+	constexpr bool params_conflict()
+	{
+		using components = typename access::all_components<access::type_list<>, A, B>::type;
+		constexpr uint64_t readsA = access::list<A>::template read_mask<components>();
+		constexpr uint64_t writesA = access::list<A>::template write_mask<components>();
+		constexpr uint64_t readsB = access::list<B>::template read_mask<components>();
+		constexpr uint64_t writesB = access::list<B>::template write_mask<components>();
+		return (writesA & (readsB | writesB)) != 0 || (writesB & readsA) != 0;
+	}
+
+	// Static dependency graph of systems scheduled in list order, one parameter list
+	// type per system (decltype of the list). System j depends on an earlier system i
+	// when their lists conflict, edges implied by other edges are dropped. The graph
+	// is conservative: it ignores archetype filters, so it also orders systems that
+	// reach each other's components through random access.
+	template<class... Lists>
+	struct system_graph
+	{
+		static constexpr size_t size = sizeof...(Lists);
+		static_assert(size <= 64, "system_graph: at most 64 systems");
+		static_assert((!access::list<Lists>::aliased && ...),
+			"system_graph: a component is passed twice in one parameter list");
+		using components = typename access::all_components<access::type_list<>, Lists...>::type;
+		static_assert(access::length(components{}) <= 64, "system_graph: at most 64 distinct components");
+
+		static constexpr std::array<uint64_t, size> reads{ access::list<Lists>::template read_mask<components>()... };
+		static constexpr std::array<uint64_t, size> writes{ access::list<Lists>::template write_mask<components>()... };
+
+		static constexpr bool conflict(size_t i, size_t j)
+		{
+			return (writes[i] & (reads[j] | writes[j])) != 0 || (writes[j] & reads[i]) != 0;
+		}
+	private:
+		struct edges
+		{
+			std::array<uint64_t, size> direct{};
+			std::array<uint32_t, size> level{};
+		};
+		static constexpr edges build()
+		{
+			edges result{};
+			std::array<uint64_t, size> reach{};
+			for (size_t j = 0; j < size; ++j)
+			{
+				// Latest first: an earlier conflict already reached through a later dependency is implied.
+				for (size_t i = j; i-- > 0;)
+				{
+					if (!conflict(i, j) || (reach[j] >> i & 1))
+						continue;
+					result.direct[j] |= 1ull << i;
+					reach[j] |= (1ull << i) | reach[i];
+					result.level[j] = std::max(result.level[j], result.level[i] + 1);
+				}
+			}
+			return result;
+		}
+		static constexpr edges graph = build();
+	public:
+		// Bits of the earlier systems system i waits for directly.
+		static constexpr std::array<uint64_t, size> dependencies = graph.direct;
+		// Length of the longest dependency chain ending at each system, systems of one level never conflict.
+		static constexpr std::array<uint32_t, size> levels = graph.level;
+
+		static constexpr bool depends(size_t system, size_t on) { return (dependencies[system] >> on & 1) != 0; }
+
+		// Pass indices stored inline, converts to a span for pipeline::depend_on.
+		struct pass_list
+		{
+			std::array<uint32_t, size> indices{};
+			size_t count = 0;
+			operator gsl::span<const uint32_t>() const { return { indices.data(), count }; }
+		};
+		// Pass indices system waits for, from the pass indices of the systems scheduled
+		// before it, in list order. Meant for pipeline::depend_on: the pipeline counts
+		// those edges, where events of the same pipeline would each cost a waiting task.
+		static pass_list dependency_passes(size_t system, gsl::span<const uint32_t> scheduled)
+		{
+			pass_list passes;
+			for (size_t i = 0; i < (size_t)scheduled.size() && i < system; ++i)
+				if (depends(system, i))
+					passes.indices[passes.count++] = scheduled[i];
+			return passes;
+		}
+	};
+}
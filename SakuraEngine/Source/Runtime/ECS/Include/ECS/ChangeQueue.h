@@ -0,0 +1,48 @@
+#pragma once
+#include "ECS/ECS.h"
+#include "TaskSystem/PerWorker.h"
+
+namespace sakura::task_system::ecs
+{
+	// Change events of one component, for sparse updates: a chunk filter selects
+	// every entity of a chunk as soon as one of them changed, the queue lists the
+	// changed entities themselves. Passes flagged with pipeline::publish_changes feed
+	// it with every entity they ran on; other writers go through get_owned_rw or push.
+	// Writers append to the list of the worker they run on, so pushing takes no
+	// lock. Consumers read the merged list where no writer runs (a pass depending
+	// on the writing passes) and the owner clears it once every consumer is done.
+	struct ECSAPI change_queue
+	{
+		explicit change_queue(sakura::ecs::index_t type);
+		~change_queue();
+		change_queue(const change_queue&) = delete;
+		change_queue& operator=(const change_queue&) = delete;
+
+		sakura::ecs::index_t type() const { return componentType; }
+		// Records that the component of e changed, for kernels writing it through their parameters.
+		void push(sakura::ecs::entity e);
+		void push(gsl::span<const sakura::ecs::entity> ents);
+		// Writable component of e, recorded as changed. nullptr, and nothing is
+		// recorded, if e does not own the component.
+		void* get_owned_rw(sakura::ecs::world& ctx, sakura::ecs::entity e);
+
+		// Entities pushed since the last clear, sorted by id and version, each once. Valid until the
+		// next collect or clear. Must not run concurrently with push.
+		gsl::span<const sakura::ecs::entity> collect();
+		// Drops every recorded change, buffers keep their capacity.
+		void clear();
+	private:
+		struct worker_list;
+		const sakura::ecs::index_t componentType;
+		task_system::per_worker<worker_list> lists;
+		sakura::vector<sakura::ecs::entity> merged;
+	};
+
+	// Runs f(entity) for every changed entity of the queue in parallel.
+	template<class F>
+	void for_each_changed(change_queue& queue, F&& f, uint32_t grain = 256)
+	{
+		const auto changed = queue.collect();
+		task_system::parallel_for((uint32_t)changed.size(), grain, [&](uint32_t i) { f(changed[i]); });
+	}
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include "ECS/ECS.h"
+#include "TaskSystem/PerWorker.h"
+
+namespace sakura::task_system::ecs
+{
+	// Deferred structural changes. Pass tasks record into the buffer of the worker
+	// they run on, so recording takes no lock. playback() applies everything at a
+	// sync point: allocations grouped by type, casts grouped by type diff and source
+	// chunk, destructions grouped by chunk, so each group is one bulk chunk operation
+	// instead of one operation per entity.
+	struct ECSAPI command_buffer
+	{
+		using initializer_t = std::function<void(const sakura::ecs::chunk_slice&)>;
+		explicit command_buffer(sakura::ecs::world& ctx);
+		~command_buffer();
+		command_buffer(const command_buffer&) = delete;
+		command_buffer& operator=(const command_buffer&) = delete;
+
+		// Types are copied, they only need to live until the call returns.
+		// initialize is called during playback for every slice of the new entities.
+		void allocate(const sakura::ecs::entity_type& type, uint32_t count, initializer_t initialize = {});
+		void cast(sakura::ecs::entity e, const sakura::ecs::type_diff& diff);
+		void destroy(sakura::ecs::entity e);
+
+		// Must not run concurrently with recording. Casts and destructions of entities
+		// that are no longer alive (destroyed directly or by another buffer since they
+		// were recorded) are dropped.
+		void playback();
+		bool empty() const;
+
+		struct stats
+		{
+			uint32_t commands = 0;
+			// World calls issued by the playback.
+			uint32_t bulkOperations = 0;
+			// Commands dropped because their entity was no longer alive.
+			uint32_t dropped = 0;
+		};
+		stats last_playback() const { return lastPlayback; }
+	private:
+		struct worker_buffer;
+		sakura::ecs::world& ctx;
+		task_system::per_worker<worker_buffer> buffers;
+		stats lastPlayback;
+	};
+}
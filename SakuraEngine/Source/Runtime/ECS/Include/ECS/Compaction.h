@@ -0,0 +1,82 @@
+#pragma once
+#include "ECS/ECS.h"
+#include "ECS/CommandBuffer.h"
+
+namespace sakura::task_system::ecs
+{
+	// Chunk occupancy of one archetype.
+	struct archetype_fragmentation
+	{
+		const sakura::ecs::archetype* type = nullptr;
+		uint32_t entities = 0;
+		uint32_t chunks = 0;
+		// Entities the largest chunk holds, from the archetype layout.
+		uint32_t chunkCapacity = 0;
+		// Entities all chunks hold together.
+		uint32_t capacity = 0;
+
+		// Entities against capacity, 1 when every chunk but the last is full.
+		float occupancy() const
+		{
+			return capacity == 0 ? 1.f : float(entities) / float(capacity);
+		}
+		// Chunks left over once the entities are packed.
+		uint32_t sparse_chunks() const
+		{
+			return chunkCapacity == 0 ? 0 : chunks - (entities + chunkCapacity - 1) / chunkCapacity;
+		}
+	};
+
+	// Occupancy of every archetype holding entities, in the world's archetype order.
+	ECSAPI sakura::vector<archetype_fragmentation> measure_fragmentation(sakura::ecs::world& ctx);
+
+	// Incremental compaction of archetypes left sparse by destroys and casts. The
+	// entities of the least filled chunks are moved into the free slots of the fuller
+	// chunks of their archetype, until every archetype needs no more chunks than its
+	// entities fill. The world offers no move within an archetype, so entities are
+	// disabled and enabled again, both directions grouped by chunk through a command
+	// buffer. This relies on the world's allocation policy: an entity enabled again
+	// takes a free slot of an existing chunk of its archetype before a new chunk is
+	// made, and a chunk left empty is released (checked by CompactionTest in ECSTest).
+	// Disabled archetypes are invisible to pass filters, so compiled pipelines see
+	// no new match. Entities keep their handles and component values.
+	// Runs at sync points only, no pass may touch the world during step().
+	struct ECSAPI compaction_job
+	{
+		// Archetypes whose occupancy is at least threshold are left alone.
+		explicit compaction_job(sakura::ecs::world& ctx, float threshold = 0.75f);
+
+		// Empties sparse chunks until budgetNs passed, at least one per call. Plans
+		// again after structural changes made elsewhere and once a plan is done, in
+		// case the world refilled chunks planned to empty. Changes made straight
+		// through the world are not counted by structural_version, so every chunk is
+		// checked to still hold the planned entities before it is emptied and the
+		// job plans again if not. Returns true while chunks are left to empty.
+		bool step(uint64_t budgetNs);
+
+		struct stats
+		{
+			uint64_t chunksEmptied = 0;
+			uint64_t entitiesMoved = 0;
+		};
+		stats total() const { return totals; }
+	private:
+		void plan();
+		// Whether the entities of planned chunk i still fill the slice they were planned from.
+		bool still_planned(uint32_t i);
+		void move(gsl::span<const sakura::ecs::entity> ents);
+		sakura::ecs::world& ctx;
+		const float threshold;
+		command_buffer commands;
+		// Entities of the chunks to empty, least filled chunk first.
+		sakura::vector<sakura::ecs::entity> pending;
+		sakura::vector<uint32_t> chunkEnds;
+		sakura::vector<sakura::ecs::chunk_slice> plannedSlices;
+		uint32_t nextChunk = 0;
+		// Chunks of the world when the plan was made.
+		uint32_t plannedChunks = 0;
+		bool planned = false;
+		uint64_t plannedVersion = 0;
+		stats totals;
+	};
+}
@@ -2,6 +2,18 @@
 #include "TaskSystem/TaskSystem.h"
 #include "RuntimeCore/RuntimeCore.h"
 #include "Codebase/Codebase.h"
+#include "ECS/Timeline.h"
+#include "ECS/FrameScratch.h"
+#include "ECS/Access.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <typeinfo>
 
 #define forloop(i, z, n) for(auto i = std::decay_t<decltype(n)>(z); i<(n); ++i)
 #define def static constexpr auto
@@ -14,49 +26,503 @@ namespace sakura
 // task_system support.
 namespace sakura::task_system::ecs
 {
-	struct pipeline final : public core::codebase::pipeline
+	struct random_writes;
+	struct change_queue;
+
+	// Dispatch state of one pass: the pass body is handed to task_system only after
+	// every dependency pass (and external event) has signalled, so no worker parks
+	// on a pass that cannot run yet.
+	struct pass_node
 	{
-		using base_t = core::codebase::pipeline;
-		pipeline(sakura::ecs::world& ctx) :base_t(ctx) {
-			pass_events.reserve(100);
+		std::atomic<uint32_t> pending = 0;
+		std::mutex lock; // guards finished & successors.
+		bool finished = false;
+		sakura::vector<uint32_t> successors;
+		// Passes of the same pipeline waited for on top of the pass's own dependencies, see depend_on.
+		sakura::vector<uint32_t> dependencies;
+		sakura::vector<task_system::Event> externalDependencies;
+		std::function<void()> body;
+		// Kept so that a compiled pipeline can replay the node, replaced when it re-matches the pass.
+		sakura::ecs::custom_pass* pass = nullptr;
+	};
+
+	// What the recording knows of a pass. Read when the pass is matched again or a
+	// feature is set up for it, dispatch does not touch it.
+	struct pass_info
+	{
+		size_t profileKey = 0;
+		const char* name = nullptr;
+		// Pipeline of pipeline::matchers owning the pass, nullptr while it is the recorded one.
+		const core::codebase::pipeline* matcher = nullptr;
+		// Creates the pass again from its filters on another pipeline, chunk passes only.
+		std::function<sakura::ecs::pass*(core::codebase::pipeline&, const sakura::ecs::filters&)> match;
+		// Sorted component types of the const parameters.
+		sakura::vector<sakura::ecs::index_t> readTypes;
+		// Sorted component types of the other parameters.
+		sakura::vector<sakura::ecs::index_t> writeTypes;
+		// Chunk filter of the pass, a fused pass must not visit fewer chunks than its own filter selects.
+		sakura::vector<sakura::ecs::index_t> changedTypes;
+		size_t changedSince = 0;
+	};
+
+	// Pass fusion, set up by pipeline::allow_fusion.
+	struct fusion_state
+	{
+		// Head pass whose tasks run this pass's kernel, -1 if not fused.
+		int fusedInto = -1;
+		// Passes folded into this one and their kernels, in schedule order.
+		sakura::vector<uint32_t> fused;
+		sakura::vector<std::function<void(const sakura::ecs::task&)>> fusedKernels;
+	};
+
+	// Change filtering, set up by pipeline::watch_changes.
+	struct watch_state
+	{
+		// Timestamp of the last run, chunks not written since are skipped.
+		size_t watermark = 0;
+		bool hasWatermark = false;
+		// Filter applied to the pass's tasks this run (union over fused passes).
+		sakura::vector<sakura::ecs::index_t> filterTypes;
+		// Union being built, swapped with filterTypes so neither is reallocated once grown.
+		sakura::vector<sakura::ecs::index_t> merged;
+	};
+
+	// Time slicing, set up by pipeline::time_slice.
+	struct slice_state
+	{
+		uint32_t period = 1;
+		uint64_t budgetNs = 0;
+		// Entity offset in the pass the next run starts from.
+		uint32_t cursor = 0;
+	};
+
+	// Append-only storage whose elements never move. Workers running launched passes
+	// index it while the recording thread keeps appending, so growing must not touch
+	// anything they read: elements live in fixed blocks and the block table is a plain
+	// array. Appending is only safe from one thread.
+	template<class T, uint32_t BlockSize = 32, uint32_t MaxBlocks = 64>
+	struct stable_list
+	{
+		stable_list() = default;
+		stable_list(const stable_list&) = delete;
+		stable_list& operator=(const stable_list&) = delete;
+		template<class... Args>
+		T& emplace_back(Args&&... args)
+		{
+			const uint32_t block = count / BlockSize;
+			assert(block < MaxBlocks && "stable_list: too many elements");
+			if (!blocks[block])
+				blocks[block] = std::make_unique<slot[]>(BlockSize);
+			auto& element = blocks[block][count % BlockSize].value;
+			element.emplace(std::forward<Args>(args)...);
+			count++;
+			return *element;
+		}
+		T& operator[](size_t i) { return *blocks[i / BlockSize][i % BlockSize].value; }
+		const T& operator[](size_t i) const { return *blocks[i / BlockSize][i % BlockSize].value; }
+		size_t size() const { return count; }
+		static constexpr size_t capacity() { return (size_t)BlockSize * MaxBlocks; }
+	private:
+		struct slot { std::optional<T> value; };
+		std::unique_ptr<slot[]> blocks[MaxBlocks];
+		uint32_t count = 0;
+	};
+
+	// Counters of the chunk filters applied by pipeline::watch_changes in one run.
+	struct change_stats
+	{
+		uint64_t processedChunks = 0;
+		uint64_t processedEntities = 0;
+		uint64_t skippedEntities = 0;
+	};
+
+	// Measured cost of one pass, carried across frames by adaptive_schedule.
+	struct pass_profile
+	{
+		double nsPerEntity = 0.0;
+		uint32_t sampledFrames = 0;
+		// Chosen for the next run.
+		int slice = -1;
+		bool parallel = false;
+	};
+
+	struct pipeline;
+
+	// Tasks a pass runs this time. Every task unless the pass is time sliced
+	// (pipeline::time_slice), then a window starting at the pass's cursor that wraps
+	// around the task array and may be cut short by the time budget.
+	struct ECSAPI slice_window
+	{
+		slice_window(pipeline& owner, const sakura::ecs::pass& pass, const sakura::ecs::chunk_vector<sakura::ecs::task>& tasks);
+		slice_window(const slice_window&) = delete;
+		slice_window& operator=(const slice_window&) = delete;
+		// Index in the task array of the i-th task of the window.
+		uint32_t task(uint32_t i) const
+		{
+			const uint32_t index = first + i;
+			return index < taskCount ? index : index - taskCount;
+		}
+		// True if the i-th task must not start because the budget ran out. Safe to
+		// call from any worker, the first task of the window always runs.
+		bool expired(uint32_t i);
+		// Moves the cursor past the tasks that ran, returns how many entities they hold.
+		uint32_t finish();
+		uint32_t first = 0;
+		uint32_t count = 0;
+	private:
+		pipeline& owner;
+		const sakura::ecs::pass& pass;
+		const sakura::ecs::chunk_vector<sakura::ecs::task>& tasks;
+		uint32_t taskCount = 0;
+		uint64_t budgetNs = 0;
+		std::chrono::steady_clock::time_point start;
+		// Tasks of the window before this one all ran.
+		std::atomic<uint32_t> stoppedAt = 0;
+	};
+
+	// Picks slice size and parallel/serial per pass from the cost measured over the
+	// last few frames instead of hard-coded maxSlice / MinParallelTask constants.
+	// Owned by the caller so that it outlives the per-frame pipelines.
+	struct ECSAPI adaptive_schedule
+	{
+		// Slices are sized so that one task costs roughly this much.
+		uint64_t targetTaskNs = 50'000;
+		// Passes cheaper than this in total stay serial.
+		uint64_t minParallelNs = 100'000;
+		// Weight of the newest frame in the moving average.
+		double smoothing = 0.25;
+
+		pass_profile& profile(size_t key);
+		void record(pass_profile& profile, uint32_t entityCount, uint64_t costNs);
+		sakura::unordered_map<size_t, pass_profile> profiles;
+	private:
+		std::mutex lock;
+	};
+
+	// Named shared resources that outlive a pipeline recording. Asking twice for the
+	// same name returns the same resource, so its storage keeps the capacity it grew
+	// to and read()/write() entries keep tracking it like any other resource.
+	// Owned by the caller (compiled_pipeline has one).
+	struct ECSAPI resource_pool
+	{
+		template<class T, class... Args>
+		sakura::ecs::shared_resource<T> acquire(std::string_view name, Args&&... args)
+		{
+			using handle_t = sakura::ecs::shared_resource<T>;
+			std::lock_guard<std::mutex> guard(lock);
+			auto& entry = entries[std::string(name)];
+			if (entry.handle)
+			{
+				assert(entry.type == typeid(T).hash_code() && "resource requested with another type");
+				reusedCount++;
+				return *static_cast<handle_t*>(entry.handle.get());
+			}
+			entry.type = typeid(T).hash_code();
+			entry.handle = std::make_shared<handle_t>(sakura::ecs::make_resource<T>(std::forward<Args>(args)...));
+			createdCount++;
+			return *static_cast<handle_t*>(entry.handle.get());
+		}
+		// Drops every resource, handles already given out stay valid.
+		void clear();
+		size_t size() const;
+		// Totals since construction.
+		uint64_t created() const { return createdCount.load(std::memory_order_relaxed); }
+		uint64_t reused() const { return reusedCount.load(std::memory_order_relaxed); }
+	private:
+		struct entry
+		{
+			size_t type = 0;
+			std::shared_ptr<void> handle;
 		};
+		mutable std::mutex lock;
+		sakura::unordered_map<std::string, entry> entries;
+		std::atomic<uint64_t> createdCount = 0;
+		std::atomic<uint64_t> reusedCount = 0;
+	};
+
+	struct ECSAPI pipeline final : public core::codebase::pipeline
+	{
+		using base_t = core::codebase::pipeline;
+		pipeline(sakura::ecs::world& ctx) :base_t(ctx) {};
 		template<class T>
 		sakura::ecs::pass* create_pass(const sakura::ecs::filters& v, T paramList, gsl::span<core::codebase::shared_entry> sharedEntries = {})
 		{
-			pass_events.emplace_back(task_system::Event::Mode::Manual);
-			return base_t::create_pass(v, paramList, sharedEntries);
+			static_assert(!access::list<T>::aliased, "create_pass: a component is passed twice in the parameter list");
+			auto& info = add_pass();
+			// Passes are keyed by their parameter list and its occurrence in the frame.
+			const size_t typeKey = typeid(T).hash_code();
+			info.profileKey = typeKey ^ (profileOrdinals[typeKey]++ * 0x9E3779B97F4A7C15ull);
+			const auto& changed = v.chunkFilter.changed;
+			info.changedTypes.assign(changed.data, changed.data + changed.length);
+			info.changedSince = v.chunkFilter.prevTimestamp;
+			boost::hana::for_each(paramList, [&](auto param)
+			{
+				using component_t = typename param_component<std::decay_t<decltype(param)>>::type;
+				if constexpr (std::is_const_v<component_t>)
+					info.readTypes.push_back(sakura::ecs::cid<std::remove_const_t<component_t>>);
+				else
+					info.writeTypes.push_back(sakura::ecs::cid<component_t>);
+			});
+			std::sort(info.readTypes.begin(), info.readTypes.end());
+			std::sort(info.writeTypes.begin(), info.writeTypes.end());
+			info.match = [paramList](core::codebase::pipeline& matcher, const sakura::ecs::filters& filter)
+			{
+				return matcher.create_pass(filter, paramList);
+			};
+			return flushing_sync([&] { return base_t::create_pass(v, paramList, sharedEntries); });
 		}
 		sakura::ecs::custom_pass* create_custom_pass(gsl::span<core::codebase::shared_entry> sharedEntries = {})
 		{
-			pass_events.emplace_back(task_system::Event::Mode::Manual);
-			return base_t::create_custom_pass(sharedEntries);
+			add_pass();
+			return flushing_sync([&] { return base_t::create_custom_pass(sharedEntries); });
 		}
 		void wait()
 		{
+			flush();
 			forloop(i, 0u, pass_events.size())
 				pass_events[i].wait();
+			if (scratch)
+				scratch->reset();
+		}
+		// Orders the pass after passes of this pipeline that create_pass can not see it
+		// conflict with, such as passes writing what it reads through random access.
+		// The edges are counted like the pass's own dependencies, no task waits on them.
+		// Called before the pass is scheduled, passIndices must be earlier passes.
+		// Passes of other pipelines are waited for through external dependencies instead.
+		void depend_on(const sakura::ecs::custom_pass& pass, gsl::span<const uint32_t> passIndices);
+		// Registers the pass body and launches it as soon as its dependency counter drops to zero.
+		void dispatch(sakura::ecs::custom_pass& pass, std::function<void()> body, gsl::span<const task_system::Event> externalDependencies);
+		// Opts the pass into fusion. A fusible pass scheduled right after another one is
+		// run as part of the same chunk sweep, every task running the first kernel and
+		// then the second on the same slice, if: its archetypes are a subset of the
+		// first pass's, neither has random access, its chunk filter is the same (or the
+		// first pass has none) and its dependencies are already covered by the first.
+		// Only passes whose kernels touch nothing but their own slice and that use no
+		// entity filter may opt in. A fusible pass is held back until the next
+		// dispatch, flush() or wait().
+		void allow_fusion(const sakura::ecs::pass& pass);
+		bool fusible(const sakura::ecs::pass& pass) const { return fusion[pass.passIndex] != nullptr; }
+		// Fusion state of the pass, nullptr if it did not opt in.
+		const fusion_state* fusion_of(const sakura::ecs::pass& pass) const { return fusion[pass.passIndex].get(); }
+		// Folds the pass into the held fusible pass if possible, true on success.
+		bool try_fuse(sakura::ecs::pass& pass, std::function<void(const sakura::ecs::task&)> kernel,
+			gsl::span<const task_system::Event> externalDependencies);
+		// Skips chunks whose const parameters were not written since the pass last ran.
+		// The filter is set up by the pipeline on every run and replaces the chunk filter
+		// the pass was created with. The first run processes every chunk. Only for passes
+		// that derive their output from the const parameters alone.
+		void watch_changes(sakura::ecs::pass& pass);
+		// Sets the chunk filter of a watched pass for this run, called when the pass starts.
+		void prepare_change_filter(sakura::ecs::pass& pass);
+		// Counts the tasks of this run and moves the watermarks of a watched pass (and its fused passes).
+		void record_changes(const sakura::ecs::pass& pass, sakura::ecs::chunk_vector<sakura::ecs::task>& tasks);
+		change_stats changes() const
+		{
+			return { processed_chunks.load(std::memory_order_relaxed), processed_entities.load(std::memory_order_relaxed),
+				skipped_entities.load(std::memory_order_relaxed) };
+		}
+		// Watermarks by pass key, taken over from a previous recording of the same systems.
+		sakura::unordered_map<size_t, size_t> inherited_watermarks;
+		// Launches the pass held for fusion, if any.
+		void flush();
+		// Runs the pass on a rotating subset of its tasks: 1/period of them per run, and
+		// no further task starts once budgetNs passed since the first one (0: no budget).
+		// The cursor is kept across runs and recordings of a compiled pipeline, so every
+		// chunk is visited in turn. Only for passes whose results may lag a few frames
+		// behind. A time-sliced pass is never fused.
+		void time_slice(const sakura::ecs::pass& pass, uint32_t period, uint64_t budgetNs = 0);
+		// Cursors by pass key, taken over from a previous recording of the same systems.
+		sakura::unordered_map<size_t, uint32_t> inherited_cursors;
+		// Lets a pass with random writes run in parallel: its kernels record the writes
+		// into writes (reached through random_writes_of) instead of writing in place,
+		// and they are applied in task order once every task is done, before dependent
+		// passes start. writes is owned by the caller. Such a pass is never fused.
+		void defer_random_writes(const sakura::ecs::pass& pass, random_writes& writes);
+		random_writes* random_writes_of(const sakura::ecs::pass& pass) const { return deferredWrites[pass.passIndex]; }
+		// Applies the deferred random writes of the pass, called when its tasks are done.
+		void apply_random_writes(const sakura::ecs::pass& pass);
+		// Feeds queue from the pass: once a task of the pass ran, every entity of its
+		// slice is pushed as changed, the pass writes queue.type() through its
+		// parameters. Consumers of the queue must depend on the pass. Writes made
+		// outside such passes still go through the queue itself. A pass that
+		// publishes its changes is never fused.
+		void publish_changes(const sakura::ecs::pass& pass, change_queue& queue);
+		change_queue* published_changes_of(const sakura::ecs::pass& pass) const { return publishedChanges[pass.passIndex]; }
+		// Pushes the entities of tk into queue, called after the task ran.
+		void publish_task(change_queue& queue, const sakura::ecs::task& tk);
+		// Runs of the owning compiled_pipeline before this one, counted across
+		// recordings. 0 for a pipeline that is not compiled. Read by pass bodies that
+		// only do their work every few frames.
+		uint64_t frame_index() const { return frameIndex; }
+		// Entities time-sliced passes left for later runs in this run.
+		uint64_t deferred_entities() const { return deferred_entities_count.load(std::memory_order_relaxed); }
+		// (head, fused) pass index pairs of the current recording.
+		const sakura::vector<std::pair<uint32_t, uint32_t>>& fused_passes() const { return fusedPasses; }
+		// One line per fused group: names (or indices) of the passes joined by " + ".
+		std::string fusion_report() const;
+		// Launches every dispatched pass again, reusing matches, edges and events.
+		// The previous run must have been waited for.
+		void rerun();
+		// Matches the chunk passes against the world's archetypes again. Passes that
+		// match more archetypes than before are replaced by their new match, under the
+		// same index, dependencies, event and node state. Returns false, leaving every
+		// pass as it was, if the graph must be recorded again instead: a re-matched pass
+		// is fused, or it now shares an archetype with a pass whose component access
+		// conflicts with its own and that it is not ordered with.
+		// The previous run must have been waited for.
+		bool rematch(sakura::ecs::world& ctx);
+		// Pass replayed under passIndex.
+		sakura::ecs::pass& pass_at(uint32_t passIndex) const { return static_cast<sakura::ecs::pass&>(*pass_nodes[passIndex].pass); }
+		// Profile of the pass in adaptive mode, nullptr otherwise.
+		pass_profile* profile_of(const sakura::ecs::pass& pass) const
+		{
+			return adaptive ? &adaptive->profile(pass_infos[pass.passIndex].profileKey) : nullptr;
+		}
+		// Label of the pass in timeline captures, name must outlive the pipeline.
+		void name_pass(const sakura::ecs::custom_pass& pass, const char* name);
+		// Nanoseconds spent waiting for external events that had not signalled when their
+		// pass was submitted. marl events take no continuation, so such a pass costs one
+		// parked waiter (one per pass, whatever the number of its events). Passes with
+		// only pipeline dependencies (depend_on included) never wait, Boids and ECSTest
+		// pass none and read 0.
+		uint64_t prologue_wait_time() const { return prologue_wait_ns.load(std::memory_order_relaxed); }
+		// Nanoseconds passes spent building and submitting their task arrays this run.
+		uint64_t schedule_overhead_time() const { return schedule_overhead_ns.load(std::memory_order_relaxed); }
+		void record_schedule_overhead(const sakura::ecs::pass& pass, uint64_t ns)
+		{
+			schedule_overhead_ns.fetch_add(ns, std::memory_order_relaxed);
+			if (timeline)
+				timeline->pass_schedule(pass.passIndex, ns);
 		}
-		sakura::vector<task_system::Event> pass_events;
+
+		// Indexed by pass. Read by running passes while more passes are recorded, see stable_list.
+		stable_list<task_system::Event> pass_events;
+		stable_list<pass_node> pass_nodes;
+		stable_list<pass_info> pass_infos;
 		bool force_no_parallel = false;
+		adaptive_schedule* adaptive = nullptr;
+		// Optional capture of pass and task spans, owned by the caller.
+		pipeline_timeline* timeline = nullptr;
+		// Per-worker arenas for kernel temporaries, owned by the caller and reset by wait().
+		frame_scratch* scratch = nullptr;
+		// Pool behind persistent_resource, owned by the caller.
+		resource_pool* resources = nullptr;
+		// Resource registered under name, reused across recordings when the pipeline has
+		// a pool and made fresh otherwise. args only construct it the first time.
+		template<class T, class... Args>
+		sakura::ecs::shared_resource<T> persistent_resource(std::string_view name, Args&&... args)
+		{
+			if (!resources)
+				return sakura::ecs::make_resource<T>(std::forward<Args>(args)...);
+			return resources->acquire<T>(name, std::forward<Args>(args)...);
+		}
+		// Arena of the calling worker, only valid inside the kernels of this pipeline.
+		sakura::scratch_arena& local_scratch() const
+		{
+			assert(scratch && "pipeline has no frame_scratch");
+			return scratch->local();
+		}
+	private:
+		friend struct slice_window;
+		// Appends the event, node, info and empty feature slots of a new pass.
+		pass_info& add_pass();
+		// Optional per-feature state, one slot per pass, empty unless the pass opted
+		// in. Slots are appended with the pass and only filled while recording it.
+		stable_list<std::unique_ptr<fusion_state>> fusion;
+		stable_list<std::unique_ptr<watch_state>> watched;
+		stable_list<std::unique_ptr<slice_state>> sliced;
+		stable_list<random_writes*> deferredWrites;
+		stable_list<change_queue*> publishedChanges;
+		void submit(uint32_t passIndex);
+		void release(uint32_t passIndex);
+		void launch(uint32_t passIndex);
+		void finish(uint32_t passIndex);
+		std::atomic<uint64_t> prologue_wait_ns = 0;
+		std::atomic<uint64_t> schedule_overhead_ns = 0;
+		std::atomic<uint64_t> processed_chunks = 0;
+		std::atomic<uint64_t> processed_entities = 0;
+		std::atomic<uint64_t> skipped_entities = 0;
+		std::atomic<uint64_t> deferred_entities_count = 0;
+		int fusionHead = -1;
+		sakura::vector<std::pair<uint32_t, uint32_t>> fusedPasses;
+		friend struct compiled_pipeline;
+		uint64_t frameIndex = 0;
+		// Base create_pass may wait on earlier passes through on_sync, a held pass must be launched first.
+		template<class F>
+		std::invoke_result_t<F> flushing_sync(F&& create)
+		{
+			if (fusionHead < 0)
+				return create();
+			auto sync = on_sync;
+			on_sync = [this, sync](gsl::span<sakura::ecs::custom_pass*> dependencies)
+			{
+				flush();
+				if (sync)
+					sync(dependencies);
+			};
+			auto created = create();
+			on_sync = std::move(sync);
+			return created;
+		}
+		sakura::unordered_map<size_t, uint32_t> profileOrdinals;
+		// Pipelines holding the passes created by rematch. One is freed as soon as no
+		// node uses a pass of it anymore, so at most one per re-matched pass is kept.
+		sakura::vector<std::unique_ptr<core::codebase::pipeline>> matchers;
 	};
+	// Version of the world's structure (archetypes and entity counts). Wrapper-side
+	// structural operations bump it; direct edits on the world must call mark_structural_change.
+	ECSAPI uint64_t structural_version(const sakura::ecs::world& ctx);
+	ECSAPI void mark_structural_change(const sakura::ecs::world& ctx);
+
+	// A frame graph recorded once and replayed every frame: archetype matches,
+	// dependency edges, pass events and kernels are kept alive between runs.
+	// Archetypes created in the world since the last run are matched before the
+	// next one (pipeline::rematch), the recipe is recorded again only if that
+	// fails, if the world lost archetypes or after invalidate(). Entities added to
+	// or removed from existing archetypes need neither, tasks are built from the
+	// archetypes' chunks at every run; pass::entityCount keeps its matching value.
+	struct ECSAPI compiled_pipeline
+	{
+		using recipe_t = std::function<void(pipeline&)>;
+		compiled_pipeline(sakura::ecs::world& ctx, recipe_t recipe);
+		// Launches one frame (bumping the pipeline timestamp), the previous one must have been waited for.
+		void run();
+		void wait();
+		pipeline& get() { return *ppl; }
+		// Number of times the recipe has been recorded.
+		uint32_t record_count() const { return records; }
+		// Number of times new archetypes were matched without recording.
+		uint32_t rematch_count() const { return rematches; }
+		// Records the recipe again at the next run, for recipes depending on more of
+		// the world than the archetypes their passes match (entity counts for instance).
+		void invalidate() { stale = true; }
+		// Restarted at every run() and handed to the recorded pipeline.
+		pipeline_timeline* timeline = nullptr;
+		// Scratch arenas of the recorded pipeline, reset by wait().
+		frame_scratch scratch;
+		// Named resources kept across recordings.
+		resource_pool resources;
+	private:
+		sakura::ecs::world& ctx;
+		recipe_t recipe;
+		std::unique_ptr<pipeline> ppl;
+		size_t recordedArchetypes = 0;
+		bool stale = false;
+		uint32_t records = 0;
+		uint32_t rematches = 0;
+		uint64_t frames = 0;
+	};
+
 	template<class F>
-	FORCEINLINE task_system::Event schedule_custom(pipeline& pipeline, sakura::ecs::custom_pass& pass, F&& t, std::vector<task_system::Event> externalDependencies = {})
+	FORCEINLINE task_system::Event schedule_custom(pipeline& pipeline, sakura::ecs::custom_pass& pass, F&& t, gsl::span<const task_system::Event> externalDependencies = {})
 	{
-		task_system::schedule([&, t, externalDependencies = std::move(externalDependencies)]() mutable
-		{
-			defer(pipeline.pass_events[pass.passIndex].signal());
-			forloop(i, 0, pass.dependencyCount)
-				pipeline.pass_events[pass.dependencies[i]->passIndex].wait();
-			for (auto& ed : externalDependencies)
-				ed.wait();
-			t();
-		});
+		pipeline.dispatch(pass, std::forward<F>(t), externalDependencies);
 		return pipeline.pass_events[pass.passIndex];
 	}
 
 	template<bool ForceParallel = false, bool ForceNoParallel = false, class F>
 	FORCEINLINE task_system::Event schedule(
-		pipeline& pipeline, sakura::ecs::pass& pass, F&& t, int maxSlice = -1, std::vector<task_system::Event> externalDependencies = {})
+		pipeline& pipeline, sakura::ecs::pass& pass, F&& t, int maxSlice = -1, gsl::span<const task_system::Event> externalDependencies = {})
 	{
 		static_assert(std::is_invocable_v<std::decay_t<F>, const task_system::ecs::pipeline&, const sakura::ecs::pass&, const sakura::ecs::task&>,
 			"F must be an invokable of void(const ecs::pipeline&, const ecs::pass&, const ecs::task&)>");
@@ -68,44 +534,84 @@ namespace sakura::task_system::ecs
 		//	e.signal();
 		//	return e;
 		//}
-		task_system::schedule([&, maxSlice, t, externalDependencies = std::move(externalDependencies)]() mutable
+		if (pipeline.fusible(pass) &&
+			pipeline.try_fuse(pass, [&pipeline, &pass, t](const sakura::ecs::task& tk) mutable { t(pipeline, pass, tk); }, externalDependencies))
+			return pipeline.pass_events[pass.passIndex];
+		// The pass is looked up at every run, a compiled pipeline may re-match it.
+		pipeline.dispatch(pass, [&pipeline, passIndex = (uint32_t)pass.passIndex, maxSlice, t]() mutable
 		{
-			defer(pipeline.pass_events[pass.passIndex].signal());
+			sakura::ecs::pass& pass = pipeline.pass_at(passIndex);
+			pass_profile* profile = pipeline.profile_of(pass);
+			const bool adaptive = profile && profile->sampledFrames > 0;
+			const auto dispatchStart = std::chrono::steady_clock::now();
+			pipeline.prepare_change_filter(pass);
 			//defer(tasks.reset());
-			forloop(i, 0, pass.dependencyCount)
-				pipeline.pass_events[pass.dependencies[i]->passIndex].wait();
-			for (auto& ed : externalDependencies)
-				ed.wait();
-			auto tasks = pipeline.create_tasks(pass, maxSlice);
+			auto tasks = pipeline.create_tasks(pass, adaptive ? profile->slice : maxSlice);
+			pipeline.record_changes(pass, tasks);
+			uint64_t scheduleNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - dispatchStart).count();
+
+			slice_window window(pipeline, pass, tasks);
 
 			constexpr auto MinParallelTask = 10u;
-			const bool recommandParallel = !pass.hasRandomWrite && tasks.size > MinParallelTask;
+			// Deferred random writes are merged in task order, the tasks may run in any order.
+			const bool deferredWrites = pipeline.random_writes_of(pass) != nullptr;
+			const bool recommandParallel = (!pass.hasRandomWrite || deferredWrites) && 
+				(adaptive ? profile->parallel : window.count > MinParallelTask);
+			std::atomic<uint64_t> costNs = 0;
+			pipeline_timeline* timeline = pipeline.timeline;
+			// Filled before the pass is launched, read-only afterwards.
+			const fusion_state* fusion = pipeline.fusion_of(pass);
+			change_queue* changes = pipeline.published_changes_of(pass);
+			auto kernel = [&](const sakura::ecs::task& tk)
+			{
+				t(pipeline, pass, tk);
+				if (fusion)
+					for (auto& fusedKernel : fusion->fusedKernels)
+						fusedKernel(tk);
+				if (changes)
+					pipeline.publish_task(*changes, tk);
+			};
+			auto run = [&](const sakura::ecs::task& tk)
+			{
+				if (!profile && !timeline)
+					return kernel(tk);
+				const auto start = std::chrono::steady_clock::now();
+				kernel(tk);
+				const auto end = std::chrono::steady_clock::now();
+				if (profile)
+					costNs.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+						end - start).count(), std::memory_order_relaxed);
+				if (timeline)
+					timeline->task(pass.passIndex, timeline->since_origin(start), timeline->since_origin(end));
+			};
+			auto sliced = [&](uint32_t i)
+			{
+				if (!window.expired(i))
+					run(tasks[window.task(i)]);
+			};
 			if (pipeline.force_no_parallel)
 				goto FORCE_NO_PARALLEL;
 			if ((recommandParallel & !ForceNoParallel) || ForceParallel)
 			{
-				task_system::WaitGroup tasksGroup((uint32_t)tasks.size);
-				forloop(tsk, 0, tasks.size)
-				{
-					auto& tk = tasks[tsk];
-					task_system::schedule([&, tasksGroup] {
-						// Decrement the WaitGroup counter when the task has finished.
-						defer(tasksGroup.done());
-						t(pipeline, pass, tk);
-						});
-				}
-				tasksGroup.wait();
+				// One submission for the whole task array, workers claim tasks from a shared cursor.
+				uint64_t submitNs = 0;
+				task_system::parallel_for(window.count, 1u, sliced, &submitNs);
+				scheduleNs += submitNs;
 			}
 			else
 			{
 			FORCE_NO_PARALLEL:
-				std::for_each(
-					tasks.begin(), tasks.end(), [&, t](auto& tk) mutable
-					{
-						t(pipeline, pass, tk);
-					});
+				forloop(i, 0u, window.count)
+					sliced(i);
 			}
-		});
+			if (deferredWrites)
+				pipeline.apply_random_writes(pass);
+			const uint32_t entityCount = window.finish();
+			pipeline.record_schedule_overhead(pass, scheduleNs);
+			if (profile)
+				pipeline.adaptive->record(*profile, entityCount, costNs.load());
+		}, externalDependencies);
 		return pipeline.pass_events[pass.passIndex];
 	}
 }
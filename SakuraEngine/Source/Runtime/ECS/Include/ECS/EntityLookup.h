@@ -0,0 +1,68 @@
+#pragma once
+#include "ECS/ECS.h"
+
+namespace sakura::task_system::ecs
+{
+	// Batched entity lookups for kernels touching entities out of their own chunks.
+	// get_owned_ro/rw(entity, type) and has_component resolve entity -> chunk -> column
+	// on every call; resolve() walks the entity table once for a whole span, then
+	// sorts the locations by chunk and by slot so that every component column is
+	// looked up once per chunk and gathered/scattered in memory order.
+	// Buffers keep their capacity, a lookup reused across frames does not allocate.
+	struct ECSAPI entity_lookup
+	{
+		struct location
+		{
+			sakura::ecs::chunk* c;
+			// Slot of the entity in its chunk.
+			uint32_t index;
+			// Position of the entity in the resolved span.
+			uint32_t order;
+		};
+		// Locations [begin, end) share one chunk.
+		struct group
+		{
+			sakura::ecs::chunk* c;
+			uint32_t begin;
+			uint32_t end;
+		};
+
+		// Replaces the content with the locations of ents, which must be alive.
+		// Duplicates are resolved once per occurrence.
+		void resolve(sakura::ecs::world& ctx, gsl::span<const sakura::ecs::entity> ents);
+		void clear();
+
+		gsl::span<const group> groups() const { return { chunkGroups.data(), chunkGroups.size() }; }
+		gsl::span<const location> locations(const group& g) const { return { resolved.data() + g.begin, (size_t)(g.end - g.begin) }; }
+		size_t size() const { return resolved.size(); }
+	private:
+		sakura::vector<location> resolved;
+		sakura::vector<group> chunkGroups;
+	};
+
+	// Runs f(location, const T*) for every resolved entity, chunk by chunk. The
+	// component pointer is nullptr for entities whose archetype does not own type,
+	// which also stands in for has_component. T must be stored inline (no buffer).
+	template<class T, class F>
+	void for_each_ro(sakura::ecs::world& ctx, const entity_lookup& lookup, sakura::ecs::index_t type, F&& f)
+	{
+		for (const auto& g : lookup.groups())
+		{
+			const T* column = static_cast<const T*>(ctx.get_owned_ro(g.c, type));
+			for (const auto& l : lookup.locations(g))
+				f(l, column ? column + l.index : nullptr);
+		}
+	}
+
+	// As for_each_ro, with writable components. Chunks owning type are stamped as changed.
+	template<class T, class F>
+	void for_each_rw(sakura::ecs::world& ctx, const entity_lookup& lookup, sakura::ecs::index_t type, F&& f)
+	{
+		for (const auto& g : lookup.groups())
+		{
+			T* column = static_cast<T*>(ctx.get_owned_rw(g.c, type));
+			for (const auto& l : lookup.locations(g))
+				f(l, column ? column + l.index : nullptr);
+		}
+	}
+}
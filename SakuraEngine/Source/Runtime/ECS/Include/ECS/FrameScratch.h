@@ -0,0 +1,35 @@
+#pragma once
+#include "SakuraSTL.hpp"
+#include "RuntimeCore/RuntimeCore.h"
+#include "Allocators/ScratchArena.h"
+#include "TaskSystem/PerWorker.h"
+#include <vector>
+
+namespace sakura::task_system::ecs
+{
+	// One scratch arena per worker for temporaries of task kernels. Kernels get the
+	// arena of the worker they run on without locking, everything they allocate stays
+	// valid until reset(), which the pipeline calls once all its passes are done.
+	struct ECSAPI frame_scratch
+	{
+		explicit frame_scratch(size_t blockSize = sakura::scratch_arena::DefaultBlockSize);
+
+		// Arena of the calling worker, created on first use.
+		sakura::scratch_arena& local();
+		// Must not run concurrently with kernels using the arenas.
+		void reset();
+		// Highest bytes used within one frame, indexed by worker.
+		sakura::vector<size_t> high_water() const;
+		// Bytes reserved by all arenas.
+		size_t capacity() const;
+		// Blocks all arenas took from the heap since construction.
+		size_t heap_allocations() const;
+	private:
+		const size_t blockSize;
+		task_system::per_worker<sakura::scratch_arena> arenas;
+	};
+
+	// Vector whose storage comes from a frame scratch arena.
+	template<class T>
+	using scratch_vector = std::vector<T, sakura::arena_allocator<T>>;
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include "ECS/ECS.h"
+#include "Math/Matrix.h"
+
+namespace sakura::task_system::ecs
+{
+	// Parent/child transforms flattened into depth levels. The children matched by a
+	// pass are indexed once per layout change, sorted by depth and in chunk order
+	// within a level; propagation then walks the levels in order, each level in
+	// parallel and with linear access to its own LocalToWorld/LocalToParent columns,
+	// instead of recursing through random entity lookups from the roots.
+	// Level 0 holds the direct children of roots, whose LocalToWorld must be final
+	// before propagate() runs.
+	struct ECSAPI hierarchy_levels
+	{
+		// Ids of the components holding the parent entity, LocalToWorld and LocalToParent (both float4x4).
+		hierarchy_levels(sakura::ecs::index_t parentType, sakura::ecs::index_t localToWorldType,
+			sakura::ecs::index_t localToParentType);
+
+		// Indexes the entities matched by pass (entities with a parent) again if any of
+		// them moved since the last build. Chunk slices are compared at every call and
+		// entities only in chunks whose Parent column was stamped since the last check
+		// (Parent writes and entities moved in, whatever moved them). Roots are looked
+		// up again when a child chunk was stamped or a structural change was marked
+		// (mark_structural_change); moving roots by direct world calls needs either, or
+		// invalidate(). Dead roots and Parent cycles are left out of propagation.
+		// Call from the pass body.
+		void refresh(pipeline& pipeline, sakura::ecs::pass& pass);
+		// Forces the next refresh to rebuild, needed after re-parenting without moving entities.
+		void invalidate() { built = false; }
+		// LocalToWorld = parent LocalToWorld * LocalToParent, one level after the other.
+		void propagate() const;
+
+		uint32_t depth() const { return levelOffsets.empty() ? 0 : (uint32_t)levelOffsets.size() - 1; }
+		size_t size() const { return nodes.size(); }
+		// Levels smaller than this run inline on the calling task.
+		uint32_t parallelThreshold = 1024;
+		uint32_t grain = 256;
+	private:
+		struct node
+		{
+			float4x4* localToWorld;
+			const float4x4* localToParent;
+			const float4x4* parentToWorld;
+		};
+		sakura::ecs::index_t parentType;
+		sakura::ecs::index_t localToWorldType;
+		sakura::ecs::index_t localToParentType;
+		// Level d is nodes[levelOffsets[d], levelOffsets[d + 1]).
+		sakura::vector<node> nodes;
+		sakura::vector<uint32_t> levelOffsets;
+		// Layout the nodes were built from: the children's slices and entities in chunk
+		// order, the roots and the slices ctx.batch returned for them.
+		sakura::vector<sakura::ecs::chunk_slice> childSlices;
+		sakura::vector<sakura::ecs::entity> childEntities;
+		sakura::vector<sakura::ecs::entity> roots;
+		sakura::vector<sakura::ecs::chunk_slice> rootSlices;
+		bool built = false;
+		// Timestamp Parent stamps are compared to, and structural_version at the last root lookup.
+		size_t checkedAt = 0;
+		uint64_t rootsVersion = 0;
+		bool unchanged(pipeline& pipeline, sakura::ecs::pass& pass, const sakura::ecs::chunk_vector<sakura::ecs::task>& tasks);
+	};
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include "ECS/ECS.h"
+#include "TaskSystem/PerWorker.h"
+
+namespace sakura::task_system::ecs
+{
+	// Deferred random writes of one pass. Tasks record component writes to arbitrary
+	// entities into the buffer of the worker they run on, tagged with the task, so
+	// recording takes no lock and the pass can run in parallel. Once every task of
+	// the pass is done the writes are applied in task order, and in record order
+	// within a task: the result is the one the serial path produces.
+	// Writes only land at the end of the pass, kernels must not read values other
+	// tasks of the same pass write through the buffer.
+	struct ECSAPI random_writes
+	{
+		explicit random_writes(sakura::ecs::world& ctx);
+		~random_writes();
+		random_writes(const random_writes&) = delete;
+		random_writes& operator=(const random_writes&) = delete;
+
+		// Copies size bytes into component type of e when the pass ends. Writes to
+		// entities that do not own the component are dropped.
+		void write(const sakura::ecs::task& tk, sakura::ecs::entity e, sakura::ecs::index_t type, const void* data, uint32_t size);
+		template<class T>
+		void write(const sakura::ecs::task& tk, sakura::ecs::entity e, const std::remove_pointer_t<sakura::ecs::value_type_t<T>>& value)
+		{
+			static_assert(std::is_pointer_v<sakura::ecs::value_type_t<T>>,
+				"random_writes: only plain (non-buffer) components can be written");
+			write(tk, e, sakura::ecs::cid<T>, &value, (uint32_t)sizeof(value));
+		}
+
+		// Applies every recorded write and clears the buffers, keeping their capacity.
+		// Must not run concurrently with recording.
+		void apply();
+		// Writes applied by the last apply().
+		uint32_t last_applied() const { return lastApplied; }
+	private:
+		struct worker_buffer;
+		struct segment_ref
+		{
+			uint32_t task;
+			worker_buffer* buffer;
+			uint32_t segment;
+		};
+		sakura::ecs::world& ctx;
+		task_system::per_worker<worker_buffer> buffers;
+		sakura::vector<segment_ref> order;
+		uint32_t lastApplied = 0;
+	};
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include "ECS/ECS.h"
+#include "System/VirtualFileSystem.h"
+#include <array>
+#include <cstring>
+
+namespace sakura::task_system::ecs
+{
+	// Chunk level world snapshots. Entities are grouped by which of the listed
+	// components they own and every group is stored as one packed column per
+	// component. Components are keyed by their guid, so a snapshot stays loadable
+	// when registration order or the component list changes. Loading maps the file
+	// (where the platform layer offers a mapping) and copies whole columns into
+	// freshly allocated chunks in parallel, nothing is deserialized per entity. The
+	// chunks are the world's own, they cannot adopt the mapped memory.
+	// Only plain listed components are stored. Unlisted components and metatypes
+	// (shared components among them) of the saved entities are dropped with a
+	// warning and counted in snapshot_stats, as are stored components a load skips.
+	// Entity handles inside components are written as is and are not remapped.
+	struct snapshot_component
+	{
+		std::array<uint8_t, 16> guid;
+		sakura::ecs::index_t type;
+		uint32_t size;
+	};
+
+	template<class... Ts>
+	std::array<snapshot_component, sizeof...(Ts)> snapshot_components()
+	{
+		static_assert((std::is_pointer_v<sakura::ecs::value_type_t<Ts>> && ...),
+			"snapshot: only plain (non-buffer) components can be stored");
+		static_assert(((sizeof(Ts::guid) == 16) && ...), "snapshot: component guids must be 16 bytes");
+		const auto make = [](const auto& guid, sakura::ecs::index_t type, uint32_t size)
+		{
+			snapshot_component component{ {}, type, size };
+			std::memcpy(component.guid.data(), &guid, component.guid.size());
+			return component;
+		};
+		return { make(Ts::guid, sakura::ecs::cid<Ts>,
+			(uint32_t)sizeof(std::remove_pointer_t<sakura::ecs::value_type_t<Ts>>))... };
+	}
+
+	struct snapshot_stats
+	{
+		uint32_t groups = 0;
+		uint32_t entities = 0;
+		uint64_t bytes = 0;
+		// Components left out: unlisted ones owned by saved entities, or stored ones not loaded.
+		uint32_t droppedComponents = 0;
+		// Saved entities whose metatypes were left out.
+		uint32_t droppedMetatypes = 0;
+	};
+
+	// Writes every entity owning at least one of components. At most 64 components.
+	ECSAPI bool save_snapshot(sakura::ecs::world& ctx, const sakura::vfs::path& path,
+		gsl::span<const snapshot_component> components, snapshot_stats* stats = nullptr);
+	// Adds the stored entities to the world. Stored components missing from components
+	// are skipped with a warning, a size mismatch fails the load before anything is allocated.
+	ECSAPI bool load_snapshot(sakura::ecs::world& ctx, const sakura::vfs::path& path,
+		gsl::span<const snapshot_component> components, snapshot_stats* stats = nullptr);
+
+	template<class... Ts>
+	bool save_snapshot(sakura::ecs::world& ctx, const sakura::vfs::path& path, snapshot_stats* stats = nullptr)
+	{
+		const auto components = snapshot_components<Ts...>();
+		return save_snapshot(ctx, path, components, stats);
+	}
+
+	template<class... Ts>
+	bool load_snapshot(sakura::ecs::world& ctx, const sakura::vfs::path& path, snapshot_stats* stats = nullptr)
+	{
+		const auto components = snapshot_components<Ts...>();
+		return load_snapshot(ctx, path, components, stats);
+	}
+}
@@ -0,0 +1,102 @@
+#pragma once
+#include "ECS/ECS.h"
+#include <cstring>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace sakura::task_system::ecs
+{
+	// Bulk entity creation. The world reserves the chunks on the calling thread
+	// (allocation is not thread safe), then the new slices are initialized in
+	// parallel on the task system, one slice per task. Slices never overlap, so
+	// initializers may write any component of their own slice.
+
+	// Allocates count entities of type and returns their slices, components uninitialized.
+	inline sakura::vector<sakura::ecs::chunk_slice> spawn_reserve(sakura::ecs::world& ctx,
+		const sakura::ecs::entity_type& type, uint32_t count)
+	{
+		sakura::vector<sakura::ecs::chunk_slice> slices;
+		for (auto slice : ctx.allocate(type, count))
+			slices.push_back(slice);
+		mark_structural_change(ctx);
+		return slices;
+	}
+
+	// Runs init(slice, sliceIndex) for every slice in parallel and waits for all of them.
+	template<class F>
+	void spawn_initialize(gsl::span<const sakura::ecs::chunk_slice> slices, F&& init, uint32_t grain = 1)
+	{
+		static_assert(std::is_invocable_v<F&, const sakura::ecs::chunk_slice&, uint32_t>,
+			"F must be an invokable of void(const ecs::chunk_slice&, uint32_t)");
+		task_system::parallel_for((uint32_t)slices.size(), grain, [&](uint32_t i) { init(slices[i], i); });
+	}
+
+	// spawn_reserve followed by spawn_initialize.
+	template<class F>
+	sakura::vector<sakura::ecs::chunk_slice> spawn(sakura::ecs::world& ctx,
+		const sakura::ecs::entity_type& type, uint32_t count, F&& init, uint32_t grain = 1)
+	{
+		auto slices = spawn_reserve(ctx, type, count);
+		spawn_initialize(slices, std::forward<F>(init), grain);
+		return slices;
+	}
+
+	namespace detail
+	{
+		template<class T>
+		using clone_value_t = std::remove_pointer_t<sakura::ecs::value_type_t<T>>;
+
+		template<class V>
+		void fill_clones(V* dst, const V& source, uint32_t count)
+		{
+			if constexpr (std::is_trivially_copyable_v<V>)
+			{
+				// Doubling copies: log2(count) memcpy calls.
+				if (count == 0)
+					return;
+				std::memcpy(dst, &source, sizeof(V));
+				for (uint32_t filled = 1; filled < count; filled *= 2)
+					std::memcpy(dst + filled, dst, sizeof(V) * std::min(filled, count - filled));
+			}
+			else
+				std::fill_n(dst, count, source);
+		}
+
+		template<class... Ts, size_t... I>
+		void clone_components(sakura::ecs::world& ctx, const sakura::ecs::chunk_slice& slice,
+			const std::tuple<clone_value_t<Ts>...>& sources, std::index_sequence<I...>)
+		{
+			(fill_clones(sakura::ecs::init_component<Ts>(ctx, slice), std::get<I>(sources), slice.count), ...);
+		}
+	}
+
+	// Clones prefab count times: every new entity has the prefab's type, the values
+	// of the Ts components are copied from the prefab (memcpy per slice for
+	// trivially copyable components) and init(slice, sliceIndex) runs afterwards
+	// for anything that differs per entity.
+	template<class... Ts, class F>
+	sakura::vector<sakura::ecs::chunk_slice> spawn_clones(sakura::ecs::world& ctx,
+		sakura::ecs::entity prefab, uint32_t count, F&& init, uint32_t grain = 1)
+	{
+		static_assert((std::is_pointer_v<sakura::ecs::value_type_t<Ts>> && ...),
+			"spawn_clones: only plain (non-buffer) components can be copied from the prefab");
+		// Values are read before any task runs, the prefab is not touched again.
+		const std::tuple<detail::clone_value_t<Ts>...> sources{
+			*static_cast<const detail::clone_value_t<Ts>*>(ctx.get_owned_ro(prefab, sakura::ecs::cid<Ts>))... };
+		auto slices = spawn_reserve(ctx, ctx.get_type(prefab), count);
+		spawn_initialize(slices, [&](const sakura::ecs::chunk_slice& slice, uint32_t index)
+		{
+			detail::clone_components<Ts...>(ctx, slice, sources, std::index_sequence_for<Ts...>{});
+			init(slice, index);
+		}, grain);
+		return slices;
+	}
+
+	template<class... Ts>
+	sakura::vector<sakura::ecs::chunk_slice> spawn_clones(sakura::ecs::world& ctx,
+		sakura::ecs::entity prefab, uint32_t count)
+	{
+		return spawn_clones<Ts...>(ctx, prefab, count, [](const sakura::ecs::chunk_slice&, uint32_t) {});
+	}
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include "RuntimeCore/RuntimeCore.h"
+#include "TaskSystem/PerWorker.h"
+#include <chrono>
+#include <deque>
+#include <mutex>
+
+namespace sakura::task_system::ecs
+{
+	// Timestamps of one pass, in nanoseconds since pipeline_timeline::begin_frame.
+	struct pass_timing
+	{
+		const char* name = nullptr;
+		int64_t readyNs = -1; // all dependencies signalled.
+		int64_t startNs = -1;
+		int64_t finishNs = -1;
+		uint32_t worker = 0;
+		// Spent creating and submitting the pass's tasks.
+		int64_t scheduleNs = 0;
+		sakura::vector<uint32_t> dependencies;
+	};
+
+	struct task_timing
+	{
+		uint32_t passIndex = 0;
+		uint32_t worker = 0;
+		int64_t startNs = 0;
+		int64_t finishNs = 0;
+	};
+
+	// Optional capture of when every pass became ready, started and finished, plus
+	// the span of every ecs::task and the worker that ran it. Exported as Chrome
+	// trace JSON (chrome://tracing, Perfetto) so frames can be diffed headless.
+	// Workers record into their own log without locking, the logs are merged when
+	// the capture is read. Reading must not run concurrently with a frame.
+	struct ECSAPI pipeline_timeline
+	{
+		using clock = std::chrono::steady_clock;
+
+		// Drops the previous capture and restarts the clock.
+		void begin_frame();
+		int64_t now() const { return since_origin(clock::now()); }
+		int64_t since_origin(clock::time_point t) const
+		{
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(t - origin).count();
+		}
+
+		// Called while recording.
+		void pass_named(uint32_t passIndex, const char* name);
+		void pass_dependencies(uint32_t passIndex, gsl::span<const uint32_t> dependencies);
+		// Called by the workers.
+		void pass_ready(uint32_t passIndex);
+		void pass_start(uint32_t passIndex);
+		void pass_finish(uint32_t passIndex);
+		// The pass ran inside the tasks of head, it takes over head's timestamps.
+		void pass_fused(uint32_t passIndex, uint32_t head);
+		void pass_schedule(uint32_t passIndex, uint64_t scheduleNs);
+		void task(uint32_t passIndex, int64_t startNs, int64_t finishNs);
+
+		// Merged capture, indexed by pass index.
+		sakura::vector<pass_timing> passes() const;
+		// Merged capture, ordered by start.
+		sakura::vector<task_timing> tasks() const;
+		// Pass indices from the first to the last pass of the longest dependency
+		// chain, following at each pass the dependency that finished last.
+		sakura::vector<uint32_t> critical_path() const;
+		std::string chrome_trace() const;
+		bool dump_chrome_trace(const char* path) const;
+	private:
+		struct pass_event
+		{
+			enum kind_t : uint8_t { ready, start, finish, fused, schedule } kind;
+			uint32_t passIndex;
+			// Timestamp, schedule time for schedule, head pass index for fused.
+			int64_t value;
+		};
+		struct worker_log
+		{
+			sakura::vector<pass_event> events;
+			sakura::vector<task_timing> tasks;
+		};
+		void record(pass_event::kind_t kind, uint32_t passIndex, int64_t value)
+		{
+			logs.local().events.push_back({ kind, passIndex, value });
+		}
+		static sakura::vector<uint32_t> critical_path(const sakura::vector<pass_timing>& passes);
+		clock::time_point origin = clock::now();
+		// Names and dependencies, indexed by pass index.
+		std::deque<pass_timing> recorded;
+		mutable std::mutex lock;
+		mutable task_system::per_worker<worker_log> logs;
+	};
+}
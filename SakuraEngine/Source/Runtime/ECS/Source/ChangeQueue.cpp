@@ -0,0 +1,62 @@
+#include "ECS/ChangeQueue.h"
+#include <algorithm>
+
+namespace sakura::task_system::ecs
+{
+	struct change_queue::worker_list
+	{
+		sakura::vector<sakura::ecs::entity> entities;
+	};
+
+	change_queue::change_queue(sakura::ecs::index_t type)
+		:componentType(type)
+	{
+
+	}
+
+	change_queue::~change_queue() = default;
+
+	void change_queue::push(sakura::ecs::entity e)
+	{
+		lists.local().entities.push_back(e);
+	}
+
+	void change_queue::push(gsl::span<const sakura::ecs::entity> ents)
+	{
+		auto& entities = lists.local().entities;
+		entities.insert(entities.end(), ents.begin(), ents.end());
+	}
+
+	void* change_queue::get_owned_rw(sakura::ecs::world& ctx, sakura::ecs::entity e)
+	{
+		void* component = ctx.get_owned_rw(e, componentType);
+		if (component)
+			push(e);
+		return component;
+	}
+
+	gsl::span<const sakura::ecs::entity> change_queue::collect()
+	{
+		merged.clear();
+		lists.for_each([&](uint32_t, const worker_list& list)
+		{
+			merged.insert(merged.end(), list.entities.begin(), list.entities.end());
+		});
+		// Sorted and deduplicated on the same key, a recycled id with a new version is another entity.
+		std::sort(merged.begin(), merged.end(), [](const sakura::ecs::entity& a, const sakura::ecs::entity& b)
+		{
+			return a.id != b.id ? a.id < b.id : a.version < b.version;
+		});
+		merged.erase(std::unique(merged.begin(), merged.end(), [](const sakura::ecs::entity& a, const sakura::ecs::entity& b)
+		{
+			return a.id == b.id && a.version == b.version;
+		}), merged.end());
+		return { merged.data(), merged.size() };
+	}
+
+	void change_queue::clear()
+	{
+		lists.for_each([](uint32_t, worker_list& list) { list.entities.clear(); });
+		merged.clear();
+	}
+}
@@ -0,0 +1,257 @@
+#include "ECS/CommandBuffer.h"
+#include <algorithm>
+
+namespace sakura::task_system::ecs
+{
+	namespace
+	{
+		using sakura::ecs::entity;
+		using sakura::ecs::index_t;
+
+		struct owned_type
+		{
+			sakura::vector<index_t> types;
+			sakura::vector<entity> metatypes;
+
+			explicit owned_type(const sakura::ecs::entity_type& type)
+				:types(type.types.data, type.types.data + type.types.length),
+				metatypes(type.metatypes.data, type.metatypes.data + type.metatypes.length) {}
+			sakura::ecs::entity_type view() const
+			{
+				using types_length_t = decltype(sakura::ecs::typeset::length);
+				using metatypes_length_t = decltype(sakura::ecs::metaset::length);
+				return { sakura::ecs::typeset{ types.data(), (types_length_t)types.size() },
+					sakura::ecs::metaset{ metatypes.data(), (metatypes_length_t)metatypes.size() } };
+			}
+			bool operator==(const sakura::ecs::entity_type& type) const
+			{
+				return std::equal(types.begin(), types.end(), type.types.data, type.types.data + type.types.length) &&
+					std::equal(metatypes.begin(), metatypes.end(), type.metatypes.data, type.metatypes.data + type.metatypes.length);
+			}
+			bool operator==(const owned_type& other) const
+			{
+				return types == other.types && metatypes == other.metatypes;
+			}
+		};
+
+		struct owned_diff
+		{
+			owned_type extend;
+			owned_type shrink;
+
+			explicit owned_diff(const sakura::ecs::type_diff& diff)
+				:extend(diff.extend), shrink(diff.shrink) {}
+			sakura::ecs::type_diff view() const { return { extend.view(), shrink.view() }; }
+			bool operator==(const sakura::ecs::type_diff& diff) const { return extend == diff.extend && shrink == diff.shrink; }
+			bool operator==(const owned_diff& other) const { return extend == other.extend && shrink == other.shrink; }
+		};
+
+		// Index of value in list, appended if missing. The last hit is checked first,
+		// a worker usually records the same type many times in a row.
+		template<class T, class V>
+		uint32_t intern(sakura::vector<T>& list, const V& value)
+		{
+			if (!list.empty() && list.back() == value)
+				return (uint32_t)list.size() - 1;
+			for (uint32_t i = 0; i < (uint32_t)list.size(); ++i)
+				if (list[i] == value)
+					return i;
+			list.emplace_back(value);
+			return (uint32_t)list.size() - 1;
+		}
+
+		// Slices of the entities, ordered so that applying them one after another never
+		// moves an entity of a slice that is still to come: within a chunk, back to front.
+		// Entities that died since they were recorded are counted in dropped and left
+		// out, their id may already belong to another entity.
+		sakura::vector<sakura::ecs::chunk_slice> sorted_slices(sakura::ecs::world& ctx, sakura::vector<entity>& ents, uint32_t& dropped)
+		{
+			const auto alive = std::remove_if(ents.begin(), ents.end(), [&](const entity& e) { return !ctx.exist(e); });
+			dropped += (uint32_t)(ents.end() - alive);
+			ents.erase(alive, ents.end());
+			std::sort(ents.begin(), ents.end(), [](const entity& a, const entity& b) { return a.id < b.id; });
+			ents.erase(std::unique(ents.begin(), ents.end()), ents.end());
+			sakura::vector<sakura::ecs::chunk_slice> slices;
+			for (auto slice : ctx.batch(ents.data(), (uint32_t)ents.size()))
+				slices.push_back(slice);
+			std::sort(slices.begin(), slices.end(), [](const sakura::ecs::chunk_slice& a, const sakura::ecs::chunk_slice& b)
+			{
+				return a.c != b.c ? std::less<const sakura::ecs::chunk*>()(a.c, b.c) : a.start > b.start;
+			});
+			return slices;
+		}
+	}
+
+	struct command_buffer::worker_buffer
+	{
+		struct allocation
+		{
+			uint32_t type;
+			uint32_t count;
+			initializer_t initialize;
+		};
+		struct cast_command
+		{
+			entity e;
+			uint32_t diff;
+		};
+		sakura::vector<owned_type> types;
+		sakura::vector<owned_diff> diffs;
+		sakura::vector<allocation> allocations;
+		sakura::vector<cast_command> casts;
+		sakura::vector<entity> destroys;
+
+		bool empty() const { return allocations.empty() && casts.empty() && destroys.empty(); }
+		void clear()
+		{
+			types.clear();
+			diffs.clear();
+			allocations.clear();
+			casts.clear();
+			destroys.clear();
+		}
+	};
+
+	command_buffer::command_buffer(sakura::ecs::world& ctx)
+		:ctx(ctx)
+	{
+
+	}
+
+	command_buffer::~command_buffer() = default;
+
+	void command_buffer::allocate(const sakura::ecs::entity_type& type, uint32_t count, initializer_t initialize)
+	{
+		if (count == 0)
+			return;
+		auto& buffer = buffers.local();
+		buffer.allocations.push_back({ intern(buffer.types, type), count, std::move(initialize) });
+	}
+
+	void command_buffer::cast(sakura::ecs::entity e, const sakura::ecs::type_diff& diff)
+	{
+		auto& buffer = buffers.local();
+		buffer.casts.push_back({ e, intern(buffer.diffs, diff) });
+	}
+
+	void command_buffer::destroy(sakura::ecs::entity e)
+	{
+		buffers.local().destroys.push_back(e);
+	}
+
+	bool command_buffer::empty() const
+	{
+		bool empty = true;
+		buffers.for_each([&](uint32_t, const worker_buffer& buffer) { empty &= buffer.empty(); });
+		return empty;
+	}
+
+	void command_buffer::playback()
+	{
+		sakura::vector<worker_buffer*> recorded;
+		buffers.for_each([&](uint32_t, worker_buffer& buffer)
+		{
+			if (!buffer.empty())
+				recorded.push_back(&buffer);
+		});
+		stats playbackStats;
+
+		// Allocations, one allocate per distinct type.
+		{
+			sakura::vector<const owned_type*> types;
+			sakura::vector<sakura::vector<worker_buffer::allocation*>> groups;
+			for (auto buffer : recorded)
+				for (auto& allocation : buffer->allocations)
+				{
+					const auto& type = buffer->types[allocation.type];
+					uint32_t group = 0;
+					while (group < types.size() && !(*types[group] == type))
+						++group;
+					if (group == types.size())
+					{
+						types.push_back(&type);
+						groups.emplace_back();
+					}
+					groups[group].push_back(&allocation);
+				}
+			for (uint32_t group = 0; group < (uint32_t)groups.size(); ++group)
+			{
+				uint32_t total = 0;
+				for (auto allocation : groups[group])
+					total += allocation->count;
+				playbackStats.commands += (uint32_t)groups[group].size();
+				playbackStats.bulkOperations++;
+				// Hand the new slices out to the initializers in record order.
+				auto next = groups[group].begin();
+				uint32_t needed = (*next)->count;
+				for (auto slice : ctx.allocate(types[group]->view(), total))
+				{
+					while (slice.count > 0 && next != groups[group].end())
+					{
+						auto part = slice;
+						part.count = std::min(needed, slice.count);
+						if ((*next)->initialize)
+							(*next)->initialize(part);
+						slice.start += part.count;
+						slice.count -= part.count;
+						needed -= part.count;
+						if (needed == 0 && ++next != groups[group].end())
+							needed = (*next)->count;
+					}
+				}
+			}
+		}
+
+		// Casts, grouped by diff, then one cast per source chunk run.
+		{
+			sakura::vector<const owned_diff*> diffs;
+			sakura::vector<sakura::vector<entity>> groups;
+			for (auto buffer : recorded)
+			{
+				playbackStats.commands += (uint32_t)buffer->casts.size();
+				for (auto& command : buffer->casts)
+				{
+					const auto& diff = buffer->diffs[command.diff];
+					uint32_t group = 0;
+					while (group < diffs.size() && !(*diffs[group] == diff))
+						++group;
+					if (group == diffs.size())
+					{
+						diffs.push_back(&diff);
+						groups.emplace_back();
+					}
+					groups[group].push_back(command.e);
+				}
+			}
+			for (uint32_t group = 0; group < (uint32_t)groups.size(); ++group)
+			{
+				const auto diff = diffs[group]->view();
+				for (auto& slice : sorted_slices(ctx, groups[group], playbackStats.dropped))
+				{
+					ctx.cast(slice, diff);
+					playbackStats.bulkOperations++;
+				}
+			}
+		}
+
+		// Destructions last, so that casts of destroyed entities still apply.
+		{
+			sakura::vector<entity> ents;
+			for (auto buffer : recorded)
+				ents.insert(ents.end(), buffer->destroys.begin(), buffer->destroys.end());
+			playbackStats.commands += (uint32_t)ents.size();
+			if (!ents.empty())
+				for (auto& slice : sorted_slices(ctx, ents, playbackStats.dropped))
+				{
+					ctx.destroy(slice);
+					playbackStats.bulkOperations++;
+				}
+		}
+
+		for (auto buffer : recorded)
+			buffer->clear();
+		if (playbackStats.commands > 0)
+			mark_structural_change(ctx);
+		lastPlayback = playbackStats;
+	}
+}
@@ -0,0 +1,191 @@
+#include "ECS/Compaction.h"
+#include <algorithm>
+#include <chrono>
+#include <functional>
+
+namespace sakura::task_system::ecs
+{
+	namespace
+	{
+		struct chunk_fill
+		{
+			uint32_t archetype;
+			sakura::ecs::chunk_slice slice;
+		};
+
+		// Entities a chunk holds when full, set by the archetype layout (its component
+		// sizes against the chunk's size class) whatever the chunk holds now.
+		uint32_t chunk_capacity(const sakura::ecs::chunk* c)
+		{
+			return c->type->chunkCapacity[(int)c->ct];
+		}
+
+		// Entities of every chunk of the world, grouped by archetype, and the occupancy
+		// of every archetype indexed like the archetypes of a pass matching everything.
+		sakura::vector<archetype_fragmentation> census(sakura::ecs::world& ctx, sakura::vector<chunk_fill>& chunks)
+		{
+			pipeline ppl(ctx);
+			auto pass = ppl.create_pass(sakura::ecs::filters{}, boost::hana::make_tuple());
+			auto tasks = ppl.create_tasks(*pass, -1);
+			chunks.clear();
+			for (auto& tk : tasks)
+				chunks.push_back({ tk.matched, tk.slice });
+			std::sort(chunks.begin(), chunks.end(), [](const chunk_fill& a, const chunk_fill& b)
+			{
+				if (a.archetype != b.archetype)
+					return a.archetype < b.archetype;
+				if (a.slice.c != b.slice.c)
+					return std::less<sakura::ecs::chunk*>()(a.slice.c, b.slice.c);
+				return a.slice.start < b.slice.start;
+			});
+			// A chunk may be split over several tasks, its entities are contiguous.
+			size_t merged = 0;
+			for (size_t i = 0; i < chunks.size(); ++i)
+			{
+				if (merged > 0 && chunks[merged - 1].slice.c == chunks[i].slice.c)
+					chunks[merged - 1].slice.count += chunks[i].slice.count;
+				else
+					chunks[merged++] = chunks[i];
+			}
+			chunks.resize(merged);
+
+			sakura::vector<archetype_fragmentation> result((size_t)pass->archetypeCount);
+			for (size_t i = 0; i < result.size(); ++i)
+				result[i].type = pass->archetypes[i];
+			for (const auto& chunk : chunks)
+			{
+				auto& fragmentation = result[chunk.archetype];
+				fragmentation.entities += chunk.slice.count;
+				fragmentation.chunks++;
+				const uint32_t capacity = chunk_capacity(chunk.slice.c);
+				fragmentation.chunkCapacity = std::max(fragmentation.chunkCapacity, capacity);
+				fragmentation.capacity += capacity;
+			}
+			return result;
+		}
+	}
+
+	sakura::vector<archetype_fragmentation> measure_fragmentation(sakura::ecs::world& ctx)
+	{
+		sakura::vector<chunk_fill> chunks;
+		auto result = census(ctx, chunks);
+		result.erase(std::remove_if(result.begin(), result.end(), [](const archetype_fragmentation& f) { return f.chunks == 0; }), result.end());
+		return result;
+	}
+
+	compaction_job::compaction_job(sakura::ecs::world& ctx, float threshold)
+		:ctx(ctx), threshold(threshold), commands(ctx)
+	{
+
+	}
+
+	void compaction_job::plan()
+	{
+		pending.clear();
+		chunkEnds.clear();
+		plannedSlices.clear();
+		nextChunk = 0;
+		sakura::vector<chunk_fill> chunks;
+		const auto fragmentation = census(ctx, chunks);
+		// Only our own moves since the last plan and no chunk freed by them: the world
+		// put the entities back into chunks planned to empty, planning again would only
+		// repeat the moves.
+		const bool stalled = planned && plannedVersion == structural_version(ctx) && chunks.size() >= plannedChunks;
+		plannedChunks = (uint32_t)chunks.size();
+		auto first = stalled ? chunks.end() : chunks.begin();
+		while (first != chunks.end())
+		{
+			const uint32_t archetype = first->archetype;
+			const auto last = std::find_if(first, chunks.end(), [&](const chunk_fill& c) { return c.archetype != archetype; });
+			const auto& f = fragmentation[archetype];
+			if (f.occupancy() < threshold && f.sparse_chunks() > 0)
+			{
+				// The fullest chunks stay and take in the entities of the others.
+				std::sort(first, last, [](const chunk_fill& a, const chunk_fill& b) { return a.slice.count > b.slice.count; });
+				// Least filled first, so that the first steps free the most chunks per move.
+				for (auto source = last; source != last - f.sparse_chunks(); )
+				{
+					--source;
+					const sakura::ecs::entity* ents = ctx.get_entities(source->slice.c) + source->slice.start;
+					pending.insert(pending.end(), ents, ents + source->slice.count);
+					chunkEnds.push_back((uint32_t)pending.size());
+					plannedSlices.push_back(source->slice);
+				}
+			}
+			first = last;
+		}
+		planned = true;
+		plannedVersion = structural_version(ctx);
+	}
+
+	bool compaction_job::still_planned(uint32_t i)
+	{
+		const uint32_t begin = i == 0 ? 0 : chunkEnds[i - 1];
+		const uint32_t count = chunkEnds[i] - begin;
+		const auto& planned = plannedSlices[i];
+		for (uint32_t j = begin; j < chunkEnds[i]; ++j)
+			if (!ctx.exist(pending[j]))
+				return false;
+		// Still in planned order: one slice, where the plan found them.
+		uint32_t slices = 0;
+		for (auto slice : ctx.batch(pending.data() + begin, count))
+			if (slices++ > 0 || slice.c != planned.c || slice.start != planned.start || slice.count != planned.count)
+				return false;
+		return slices == 1;
+	}
+
+	void compaction_job::move(gsl::span<const sakura::ecs::entity> ents)
+	{
+		// Already disabled entities are not matched by census, disabling is never a no-op.
+		sakura::ecs::index_t tag[] = { core::database::disable_id };
+		sakura::ecs::type_diff out;
+		out.extend = sakura::ecs::entity_type{ {tag} };
+		sakura::ecs::type_diff back;
+		back.shrink = sakura::ecs::entity_type{ {tag} };
+		// Out of the chunk first, the world releases it once it is empty, then back
+		// into the free slots left in the other chunks of the archetype.
+		for (auto e : ents)
+			commands.cast(e, out);
+		commands.playback();
+		for (auto e : ents)
+			commands.cast(e, back);
+		commands.playback();
+	}
+
+	bool compaction_job::step(uint64_t budgetNs)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		const auto elapsed = [&] { return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count(); };
+		// Entities listed in the plan may be gone or moved after changes made by others.
+		if (!planned || plannedVersion != structural_version(ctx) || (nextChunk == chunkEnds.size() && !chunkEnds.empty()))
+			plan();
+		bool replanned = false;
+		while (nextChunk < chunkEnds.size())
+		{
+			if (!still_planned(nextChunk))
+			{
+				// Moved by calls the structural version does not see. Planned again once,
+				// the fresh plan is not stalled by our own earlier moves.
+				if (!replanned)
+				{
+					planned = false;
+					plan();
+					replanned = true;
+				}
+				else
+					nextChunk++;
+				continue;
+			}
+			const uint32_t begin = nextChunk == 0 ? 0 : chunkEnds[nextChunk - 1];
+			const uint32_t end = chunkEnds[nextChunk++];
+			move({ pending.data() + begin, (size_t)(end - begin) });
+			totals.chunksEmptied++;
+			totals.entitiesMoved += end - begin;
+			plannedVersion = structural_version(ctx);
+			if (elapsed() >= budgetNs)
+				break;
+		}
+		// A finished plan is checked by the next step, which plans again.
+		return !chunkEnds.empty();
+	}
+}
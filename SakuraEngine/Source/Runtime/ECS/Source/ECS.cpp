@@ -1,4 +1,9 @@
 #include "ECS/ECS.h"
+#include "ECS/RandomWrites.h"
+#include "ECS/ChangeQueue.h"
+#include <algorithm>
+#include <cassert>
+#include <chrono>
 
 ECSModule* ECSModule::create()
 {
@@ -22,3 +27,717 @@ bool ECSModule::Terminate()
 {
 	return true;
 }
+
+namespace sakura::task_system::ecs
+{
+	pass_info& pipeline::add_pass()
+	{
+		pass_events.emplace_back(task_system::Event::Mode::Manual);
+		pass_nodes.emplace_back();
+		fusion.emplace_back();
+		watched.emplace_back();
+		sliced.emplace_back();
+		deferredWrites.emplace_back();
+		publishedChanges.emplace_back();
+		return pass_infos.emplace_back();
+	}
+
+	void pipeline::depend_on(const sakura::ecs::custom_pass& pass, gsl::span<const uint32_t> passIndices)
+	{
+		auto& dependencies = pass_nodes[pass.passIndex].dependencies;
+		for (auto passIndex : passIndices)
+		{
+			// Earlier passes only, the graph stays acyclic.
+			assert((int)passIndex < (int)pass.passIndex && "depend_on: a pass can only wait for earlier passes");
+			bool known = std::find(dependencies.begin(), dependencies.end(), passIndex) != dependencies.end();
+			for (int i = 0; i < pass.dependencyCount && !known; ++i)
+				known = (uint32_t)pass.dependencies[i]->passIndex == passIndex;
+			if (!known)
+				dependencies.push_back(passIndex);
+		}
+	}
+
+	void pipeline::dispatch(sakura::ecs::custom_pass& pass, std::function<void()> body, gsl::span<const task_system::Event> externalDependencies)
+	{
+		auto& node = pass_nodes[pass.passIndex];
+		node.body = std::move(body);
+		node.pass = &pass;
+		node.externalDependencies.assign(externalDependencies.begin(), externalDependencies.end());
+		if (timeline)
+		{
+			timeline->pass_named(pass.passIndex, pass_infos[pass.passIndex].name);
+			sakura::vector<uint32_t> dependencies;
+			for (int i = 0; i < pass.dependencyCount; ++i)
+				dependencies.push_back((uint32_t)pass.dependencies[i]->passIndex);
+			dependencies.insert(dependencies.end(), node.dependencies.begin(), node.dependencies.end());
+			timeline->pass_dependencies(pass.passIndex, dependencies);
+		}
+		if (fusionHead >= 0 && fusionHead != (int)pass.passIndex)
+			flush();
+		if (fusion[pass.passIndex] && externalDependencies.empty())
+		{
+			// Held back, the next fusible pass may still fold into it.
+			fusionHead = (int)pass.passIndex;
+			return;
+		}
+		submit(pass.passIndex);
+	}
+
+	bool pipeline::try_fuse(sakura::ecs::pass& pass, std::function<void(const sakura::ecs::task&)> kernel,
+		gsl::span<const task_system::Event> externalDependencies)
+	{
+		if (fusionHead < 0 || !externalDependencies.empty() || pass.hasRandomWrite)
+			return false;
+		// Only passes opted in through allow_fusion(const pass&) are ever held.
+		auto& head = *fusion[fusionHead];
+		auto& node = *fusion[pass.passIndex];
+		const auto& headInfo = pass_infos[fusionHead];
+		const auto& info = pass_infos[pass.passIndex];
+		const auto& headPass = pass_at((uint32_t)fusionHead);
+		auto plain = [&](uint32_t passIndex)
+		{
+			return !sliced[passIndex] && !deferredWrites[passIndex] && !publishedChanges[passIndex];
+		};
+		if (headPass.hasRandomWrite || !plain((uint32_t)fusionHead) || !plain(pass.passIndex))
+			return false;
+		// The head's tasks must cover every chunk the pass would visit on its own.
+		if (!headInfo.changedTypes.empty() && (watched[pass.passIndex] ||
+			headInfo.changedTypes != info.changedTypes || headInfo.changedSince != info.changedSince))
+			return false;
+		// Head archetype -> archetype of the pass, -1 where the pass does not match.
+		sakura::vector<int> matched((size_t)headPass.archetypeCount, -1);
+		bool identical = headPass.archetypeCount == pass.archetypeCount;
+		for (int i = 0; i < pass.archetypeCount; ++i)
+		{
+			const auto begin = headPass.archetypes, end = headPass.archetypes + headPass.archetypeCount;
+			const auto at = std::find(begin, end, pass.archetypes[i]);
+			if (at == end)
+				return false;
+			matched[at - begin] = i;
+			identical &= at - begin == i;
+		}
+		// The fused sweep starts once the head's dependencies are done, so every
+		// dependency of the pass must be the head, one of its fused passes or one of its dependencies.
+		const auto& headNode = pass_nodes[fusionHead];
+		auto covered = [&](int passIndex)
+		{
+			if (passIndex == fusionHead ||
+				std::find(head.fused.begin(), head.fused.end(), (uint32_t)passIndex) != head.fused.end() ||
+				std::find(headNode.dependencies.begin(), headNode.dependencies.end(), (uint32_t)passIndex) != headNode.dependencies.end())
+				return true;
+			for (int i = 0; i < headPass.dependencyCount; ++i)
+				if (headPass.dependencies[i]->passIndex == passIndex)
+					return true;
+			return false;
+		};
+		for (int i = 0; i < pass.dependencyCount; ++i)
+			if (!covered(pass.dependencies[i]->passIndex))
+				return false;
+		for (auto dependency : pass_nodes[pass.passIndex].dependencies)
+			if (!covered((int)dependency))
+				return false;
+		pass_nodes[pass.passIndex].pass = &pass;
+		node.fusedInto = fusionHead;
+		head.fused.push_back(pass.passIndex);
+		if (identical)
+			head.fusedKernels.push_back(std::move(kernel));
+		else
+			head.fusedKernels.push_back([matched = std::move(matched), kernel = std::move(kernel)](const sakura::ecs::task& tk)
+			{
+				if (matched[tk.matched] < 0)
+					return;
+				auto local = tk;
+				local.matched = (uint32_t)matched[tk.matched];
+				kernel(local);
+			});
+		fusedPasses.emplace_back((uint32_t)fusionHead, (uint32_t)pass.passIndex);
+		if (timeline)
+			timeline->pass_named(pass.passIndex, info.name);
+		return true;
+	}
+
+	void pipeline::allow_fusion(const sakura::ecs::pass& pass)
+	{
+		if (!fusion[pass.passIndex])
+			fusion[pass.passIndex] = std::make_unique<fusion_state>();
+	}
+
+	void pipeline::watch_changes(sakura::ecs::pass& pass)
+	{
+		auto& info = pass_infos[pass.passIndex];
+		auto& state = watched[pass.passIndex];
+		if (!state)
+			state = std::make_unique<watch_state>();
+		info.changedTypes.clear();
+		const auto inherited = inherited_watermarks.find(info.profileKey);
+		if (inherited != inherited_watermarks.end())
+		{
+			state->watermark = inherited->second;
+			state->hasWatermark = true;
+		}
+		pass.filter.chunkFilter = {};
+	}
+
+	void pipeline::time_slice(const sakura::ecs::pass& pass, uint32_t period, uint64_t budgetNs)
+	{
+		auto& state = sliced[pass.passIndex];
+		if (!state)
+			state = std::make_unique<slice_state>();
+		state->period = std::max(period, 1u);
+		state->budgetNs = budgetNs;
+		fusion[pass.passIndex].reset();
+		const auto inherited = inherited_cursors.find(pass_infos[pass.passIndex].profileKey);
+		if (inherited != inherited_cursors.end())
+			state->cursor = inherited->second;
+	}
+
+	void pipeline::defer_random_writes(const sakura::ecs::pass& pass, random_writes& writes)
+	{
+		deferredWrites[pass.passIndex] = &writes;
+		fusion[pass.passIndex].reset();
+	}
+
+	void pipeline::publish_changes(const sakura::ecs::pass& pass, change_queue& queue)
+	{
+		const auto& info = pass_infos[pass.passIndex];
+		assert(std::binary_search(info.writeTypes.begin(), info.writeTypes.end(), queue.type()) &&
+			"publish_changes: the pass does not write the queue's component");
+		publishedChanges[pass.passIndex] = &queue;
+		fusion[pass.passIndex].reset();
+	}
+
+	void pipeline::publish_task(change_queue& queue, const sakura::ecs::task& tk)
+	{
+		const sakura::ecs::entity* ents = ctx.get_entities(tk.slice.c) + tk.slice.start;
+		queue.push({ ents, (size_t)tk.slice.count });
+	}
+
+	void pipeline::apply_random_writes(const sakura::ecs::pass& pass)
+	{
+		if (auto writes = deferredWrites[pass.passIndex])
+			writes->apply();
+	}
+
+	slice_window::slice_window(pipeline& owner, const sakura::ecs::pass& pass, const sakura::ecs::chunk_vector<sakura::ecs::task>& tasks)
+		:owner(owner), pass(pass), tasks(tasks), taskCount((uint32_t)tasks.size)
+	{
+		const slice_state* state = owner.sliced[pass.passIndex].get();
+		count = taskCount;
+		stoppedAt.store(count, std::memory_order_relaxed);
+		if (!state || taskCount == 0)
+			return;
+		// The window starts at the task holding the cursor, or wraps to the first one.
+		uint32_t offset = 0;
+		while (first < taskCount && offset + tasks[first].slice.count <= state->cursor)
+			offset += tasks[first++].slice.count;
+		if (first == taskCount)
+			first = 0;
+		count = (taskCount + state->period - 1) / state->period;
+		stoppedAt.store(count, std::memory_order_relaxed);
+		budgetNs = state->budgetNs;
+		start = std::chrono::steady_clock::now();
+	}
+
+	bool slice_window::expired(uint32_t i)
+	{
+		if (budgetNs == 0)
+			return false;
+		if (i >= stoppedAt.load(std::memory_order_relaxed))
+			return true;
+		if (i == 0 || (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - start).count() < budgetNs)
+			return false;
+		// stoppedAt only decreases, so every task before its final value ran.
+		uint32_t stopped = stoppedAt.load(std::memory_order_relaxed);
+		while (i < stopped && !stoppedAt.compare_exchange_weak(stopped, i, std::memory_order_relaxed));
+		return true;
+	}
+
+	uint32_t slice_window::finish()
+	{
+		slice_state* state = owner.sliced[pass.passIndex].get();
+		if (!state || taskCount == 0)
+			return pass.entityCount;
+		const uint32_t ran = stoppedAt.load(std::memory_order_relaxed);
+		uint32_t entities = 0, total = 0, next = 0;
+		for (uint32_t i = 0; i < ran; ++i)
+			entities += tasks[task(i)].slice.count;
+		// Tasks past the window end may have run as well, they simply run again next time.
+		const uint32_t resume = ran < taskCount ? task(ran) : first;
+		for (uint32_t i = 0; i < taskCount; ++i)
+		{
+			if (i == resume)
+				next = total;
+			total += tasks[i].slice.count;
+		}
+		state->cursor = next;
+		owner.deferred_entities_count.fetch_add(total - entities, std::memory_order_relaxed);
+		return entities;
+	}
+
+	void pipeline::prepare_change_filter(sakura::ecs::pass& pass)
+	{
+		watch_state* state = watched[pass.passIndex].get();
+		if (!state)
+			return;
+		// Fused passes run on the same tasks: the filter selects every chunk any of them would.
+		bool filtered = state->hasWatermark;
+		size_t since = state->watermark;
+		state->filterTypes = pass_infos[pass.passIndex].readTypes;
+		if (const fusion_state* fused = fusion[pass.passIndex].get())
+			for (auto fusedIndex : fused->fused)
+			{
+				const watch_state* other = watched[fusedIndex].get();
+				if (!other || !other->hasWatermark)
+				{
+					filtered = false;
+					break;
+				}
+				since = std::min(since, other->watermark);
+				const auto& readTypes = pass_infos[fusedIndex].readTypes;
+				state->merged.clear();
+				std::set_union(state->filterTypes.begin(), state->filterTypes.end(),
+					readTypes.begin(), readTypes.end(), std::back_inserter(state->merged));
+				state->filterTypes.swap(state->merged);
+			}
+		if (filtered && !state->filterTypes.empty())
+		{
+			using length_t = decltype(sakura::ecs::typeset::length);
+			pass.filter.chunkFilter = { sakura::ecs::typeset{ state->filterTypes.data(), (length_t)state->filterTypes.size() }, since };
+		}
+		else
+			pass.filter.chunkFilter = {};
+	}
+
+	void pipeline::record_changes(const sakura::ecs::pass& pass, sakura::ecs::chunk_vector<sakura::ecs::task>& tasks)
+	{
+		watch_state* state = watched[pass.passIndex].get();
+		if (!state)
+			return;
+		uint64_t chunks = 0, entities = 0;
+		const sakura::ecs::chunk* last = nullptr;
+		for (const auto& tk : tasks)
+		{
+			entities += tk.slice.count;
+			if (tk.slice.c != last)
+			{
+				chunks++;
+				last = tk.slice.c;
+			}
+		}
+		processed_chunks.fetch_add(chunks, std::memory_order_relaxed);
+		processed_entities.fetch_add(entities, std::memory_order_relaxed);
+		skipped_entities.fetch_add(pass.entityCount > entities ? pass.entityCount - entities : 0, std::memory_order_relaxed);
+		const size_t timestamp = get_timestamp();
+		state->watermark = timestamp;
+		state->hasWatermark = true;
+		if (const fusion_state* fused = fusion[pass.passIndex].get())
+			for (auto fusedIndex : fused->fused)
+				if (watch_state* other = watched[fusedIndex].get())
+				{
+					other->watermark = timestamp;
+					other->hasWatermark = true;
+				}
+	}
+
+	void pipeline::flush()
+	{
+		if (fusionHead < 0)
+			return;
+		const auto head = (uint32_t)fusionHead;
+		fusionHead = -1;
+		submit(head);
+	}
+
+	std::string pipeline::fusion_report() const
+	{
+		auto label = [&](uint32_t passIndex)
+		{
+			const char* name = pass_infos[passIndex].name;
+			return name ? std::string(name) : fmt::format("pass {}", passIndex);
+		};
+		std::string report;
+		for (uint32_t i = 0; i < (uint32_t)pass_nodes.size(); ++i)
+		{
+			const fusion_state* state = fusion[i].get();
+			if (!state || state->fused.empty())
+				continue;
+			report += label(i);
+			for (auto fused : state->fused)
+				report += " + " + label(fused);
+			report += "\n";
+		}
+		return report;
+	}
+
+	void pipeline::name_pass(const sakura::ecs::custom_pass& pass, const char* name)
+	{
+		pass_infos[pass.passIndex].name = name;
+		if (timeline)
+			timeline->pass_named(pass.passIndex, name);
+	}
+
+	void pipeline::rerun()
+	{
+		prologue_wait_ns.store(0, std::memory_order_relaxed);
+		schedule_overhead_ns.store(0, std::memory_order_relaxed);
+		processed_chunks.store(0, std::memory_order_relaxed);
+		processed_entities.store(0, std::memory_order_relaxed);
+		skipped_entities.store(0, std::memory_order_relaxed);
+		deferred_entities_count.store(0, std::memory_order_relaxed);
+		for (size_t i = 0; i < pass_events.size(); ++i)
+			pass_events[i].clear();
+		// Reset every node before any is submitted, edges are registered against them.
+		for (size_t i = 0; i < pass_nodes.size(); ++i)
+		{
+			pass_nodes[i].finished = false;
+			pass_nodes[i].successors.clear();
+		}
+		for (uint32_t i = 0; i < (uint32_t)pass_nodes.size(); ++i)
+			if (pass_nodes[i].pass && (!fusion[i] || fusion[i]->fusedInto < 0))
+				submit(i);
+	}
+
+	namespace
+	{
+		template<class T>
+		bool intersects(const sakura::vector<T>& a, const sakura::vector<T>& b)
+		{
+			auto i = a.begin(), j = b.begin();
+			while (i != a.end() && j != b.end())
+			{
+				if (*i == *j)
+					return true;
+				if (*i < *j)
+					++i;
+				else
+					++j;
+			}
+			return false;
+		}
+
+		bool contains(const sakura::ecs::pass& pass, const sakura::ecs::archetype* type)
+		{
+			const auto end = pass.archetypes + pass.archetypeCount;
+			return std::find(pass.archetypes, end, type) != end;
+		}
+
+		bool depends_on(const pass_node& node, const sakura::ecs::custom_pass& pass, int passIndex)
+		{
+			for (int i = 0; i < pass.dependencyCount; ++i)
+				if (pass.dependencies[i]->passIndex == passIndex)
+					return true;
+			return std::find(node.dependencies.begin(), node.dependencies.end(), (uint32_t)passIndex) != node.dependencies.end();
+		}
+	}
+
+	bool pipeline::rematch(sakura::ecs::world& ctx)
+	{
+		auto matcher = std::make_unique<core::codebase::pipeline>(ctx);
+		// Its passes never run, there is nothing to wait for.
+		matcher->on_sync = [](gsl::span<sakura::ecs::custom_pass*>) {};
+		// Archetypes are only added, a pass matching as many as before matches the same ones.
+		sakura::vector<std::pair<uint32_t, sakura::ecs::pass*>> grown;
+		for (uint32_t i = 0; i < (uint32_t)pass_nodes.size(); ++i)
+		{
+			const auto& info = pass_infos[i];
+			if (!info.match || !pass_nodes[i].pass)
+				continue;
+			const auto& pass = pass_at(i);
+			sakura::ecs::pass* matched = info.match(*matcher, pass.filter);
+			if (matched->archetypeCount == pass.archetypeCount)
+				continue;
+			// Fused kernels map the head's archetypes to their own, fixed when fused.
+			if (const fusion_state* state = fusion[i].get(); state && (state->fusedInto >= 0 || !state->fused.empty()))
+				return false;
+			grown.emplace_back(i, matched);
+		}
+		if (grown.empty())
+			return true;
+		// Dependencies were set up from the archetypes shared at recording, a new shared
+		// archetype may order two passes that were independent.
+		auto current = [&](uint32_t passIndex) -> const sakura::ecs::pass&
+		{
+			for (const auto& g : grown)
+				if (g.first == passIndex)
+					return *g.second;
+			return pass_at(passIndex);
+		};
+		for (const auto& [index, matched] : grown)
+		{
+			const auto& info = pass_infos[index];
+			const auto& previous = pass_at(index);
+			for (int a = 0; a < matched->archetypeCount; ++a)
+			{
+				const sakura::ecs::archetype* type = matched->archetypes[a];
+				if (contains(previous, type))
+					continue;
+				for (uint32_t j = 0; j < (uint32_t)pass_nodes.size(); ++j)
+				{
+					const auto& other = pass_infos[j];
+					if (j == index || !other.match || !pass_nodes[j].pass || !contains(current(j), type))
+						continue;
+					const bool conflict = intersects(info.writeTypes, other.writeTypes) ||
+						intersects(info.writeTypes, other.readTypes) || intersects(info.readTypes, other.writeTypes);
+					const bool ordered = j < index ?
+						depends_on(pass_nodes[index], previous, (int)j) : depends_on(pass_nodes[j], pass_at(j), (int)index);
+					if (conflict && !ordered)
+						return false;
+				}
+			}
+		}
+		for (auto& [index, matched] : grown)
+		{
+			const auto& previous = pass_at(index);
+			matched->passIndex = previous.passIndex;
+			// Points into the recorded pipeline, whatever matcher previous came from.
+			matched->dependencies = previous.dependencies;
+			matched->dependencyCount = previous.dependencyCount;
+			pass_nodes[index].pass = matched;
+			pass_infos[index].matcher = matcher.get();
+		}
+		matchers.push_back(std::move(matcher));
+		// The previous run was waited for, passes no node refers to are not used anymore.
+		matchers.erase(std::remove_if(matchers.begin(), matchers.end(), [&](const auto& m)
+		{
+			for (uint32_t i = 0; i < (uint32_t)pass_nodes.size(); ++i)
+				if (pass_infos[i].matcher == m.get())
+					return false;
+			return true;
+		}), matchers.end());
+		return true;
+	}
+
+	void pipeline::submit(uint32_t passIndex)
+	{
+		auto& node = pass_nodes[passIndex];
+		const auto& pass = *node.pass;
+		// One extra count keeps the pass from launching before all edges are registered.
+		node.pending.store(1u + pass.dependencyCount + (uint32_t)node.dependencies.size() +
+			(uint32_t)node.externalDependencies.size());
+		auto wait_for = [&](uint32_t dependencyIndex)
+		{
+			auto& dependency = pass_nodes[dependencyIndex];
+			std::unique_lock<std::mutex> guard(dependency.lock);
+			if (dependency.finished)
+			{
+				guard.unlock();
+				node.pending.fetch_sub(1);
+			}
+			else
+				dependency.successors.push_back(passIndex);
+		};
+		for (int i = 0; i < pass.dependencyCount; ++i)
+			wait_for((uint32_t)pass.dependencies[i]->passIndex);
+		for (auto dependency : node.dependencies)
+			wait_for(dependency);
+		// Signalled events count as done, the others are left to one waiter.
+		uint32_t unsignalled = 0;
+		for (const auto& event : node.externalDependencies)
+		{
+			if (event.isSignalled())
+				node.pending.fetch_sub(1);
+			else
+				unsignalled++;
+		}
+		if (unsignalled > 0)
+		{
+			// marl events carry no continuation, so the pass's unsignalled events are
+			// waited for by a single task that releases them all at once. Its time is
+			// accounted so it shows up in the counter. The events are looked up rather
+			// than captured, keeping the task small enough to be stored without an allocation.
+			task_system::schedule([this, passIndex, unsignalled]
+			{
+				const auto start = std::chrono::steady_clock::now();
+				for (auto& event : pass_nodes[passIndex].externalDependencies)
+					event.wait();
+				const auto waited = std::chrono::steady_clock::now() - start;
+				prologue_wait_ns.fetch_add(
+					std::chrono::duration_cast<std::chrono::nanoseconds>(waited).count(), std::memory_order_relaxed);
+				if (pass_nodes[passIndex].pending.fetch_sub(unsignalled) == unsignalled)
+					launch(passIndex);
+			});
+		}
+		release(passIndex);
+	}
+
+	void pipeline::release(uint32_t passIndex)
+	{
+		if (pass_nodes[passIndex].pending.fetch_sub(1) == 1)
+			launch(passIndex);
+	}
+
+	void pipeline::launch(uint32_t passIndex)
+	{
+		if (timeline)
+			timeline->pass_ready(passIndex);
+		task_system::schedule([this, passIndex]
+		{
+			if (timeline)
+				timeline->pass_start(passIndex);
+			pass_nodes[passIndex].body();
+			if (timeline)
+				timeline->pass_finish(passIndex);
+			finish(passIndex);
+		});
+	}
+
+	void pipeline::finish(uint32_t passIndex)
+	{
+		auto& node = pass_nodes[passIndex];
+		{
+			std::lock_guard<std::mutex> guard(node.lock);
+			node.finished = true;
+		}
+		// No edge is added once finished is set, so the list is stable. It is only
+		// cleared by rerun, its capacity is reused by the next run.
+		for (auto successor : node.successors)
+			release(successor);
+		// Fused passes ran inside this one.
+		if (const fusion_state* state = fusion[passIndex].get())
+			for (auto fused : state->fused)
+			{
+				if (timeline)
+					timeline->pass_fused(fused, passIndex);
+				finish(fused);
+			}
+		// Signal last: once wait() returns nothing of this run touches the node again.
+		pass_events[passIndex].signal();
+	}
+
+	namespace
+	{
+		std::mutex structuralLock;
+		sakura::unordered_map<const sakura::ecs::world*, uint64_t> structuralVersions;
+	}
+
+	uint64_t structural_version(const sakura::ecs::world& ctx)
+	{
+		std::lock_guard<std::mutex> guard(structuralLock);
+		return structuralVersions[&ctx];
+	}
+
+	void mark_structural_change(const sakura::ecs::world& ctx)
+	{
+		std::lock_guard<std::mutex> guard(structuralLock);
+		structuralVersions[&ctx]++;
+	}
+
+	namespace
+	{
+		// Archetypes the world holds, whether or not they have entities.
+		size_t archetype_count(const sakura::ecs::world& ctx)
+		{
+			return ctx.archetypes.size();
+		}
+	}
+
+	compiled_pipeline::compiled_pipeline(sakura::ecs::world& ctx, recipe_t recipe)
+		:ctx(ctx), recipe(std::move(recipe))
+	{
+
+	}
+
+	void compiled_pipeline::run()
+	{
+		const size_t archetypes = archetype_count(ctx);
+		if (timeline)
+			timeline->begin_frame();
+		if (ppl && !stale && archetypes != recordedArchetypes)
+		{
+			if (archetypes > recordedArchetypes && ppl->rematch(ctx))
+			{
+				recordedArchetypes = archetypes;
+				rematches++;
+			}
+			else
+				stale = true;
+		}
+		const uint64_t frameIndex = frames++;
+		if (ppl && !stale)
+		{
+			ppl->timeline = timeline;
+			ppl->frameIndex = frameIndex;
+			ppl->inc_timestamp();
+			return ppl->rerun();
+		}
+		// Recording schedules the passes right away.
+		sakura::unordered_map<size_t, size_t> watermarks;
+		sakura::unordered_map<size_t, uint32_t> cursors;
+		if (ppl)
+			for (size_t i = 0; i < ppl->pass_infos.size(); ++i)
+			{
+				const size_t key = ppl->pass_infos[i].profileKey;
+				if (const watch_state* state = ppl->watched[i].get(); state && state->hasWatermark)
+					watermarks[key] = state->watermark;
+				if (const slice_state* state = ppl->sliced[i].get())
+					cursors[key] = state->cursor;
+			}
+		ppl = std::make_unique<pipeline>(ctx);
+		ppl->inherited_watermarks = std::move(watermarks);
+		ppl->inherited_cursors = std::move(cursors);
+		ppl->timeline = timeline;
+		ppl->scratch = &scratch;
+		ppl->resources = &resources;
+		ppl->frameIndex = frameIndex;
+		ppl->inc_timestamp();
+		recordedArchetypes = archetypes;
+		stale = false;
+		records++;
+		recipe(*ppl);
+		ppl->flush();
+	}
+
+	void compiled_pipeline::wait()
+	{
+		if (ppl)
+			ppl->wait();
+	}
+}
+
+namespace sakura::task_system::ecs
+{
+	void resource_pool::clear()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		entries.clear();
+	}
+
+	size_t resource_pool::size() const
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		return entries.size();
+	}
+
+	pass_profile& adaptive_schedule::profile(size_t key)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		return profiles[key];
+	}
+
+	void adaptive_schedule::record(pass_profile& profile, uint32_t entityCount, uint64_t costNs)
+	{
+		if (entityCount == 0)
+			return;
+		const double sample = (double)costNs / entityCount;
+		profile.nsPerEntity = profile.sampledFrames == 0 ? sample :
+			profile.nsPerEntity + (sample - profile.nsPerEntity) * smoothing;
+		profile.sampledFrames++;
+
+		const double passNs = profile.nsPerEntity * entityCount;
+		profile.parallel = entityCount > 1 && passNs >= minParallelNs;
+		if (!profile.parallel)
+		{
+			// One task per chunk, the pass runs inline anyway.
+			profile.slice = -1;
+			return;
+		}
+		const auto scheduler = task_system::Scheduler::get();
+		const uint32_t workers = scheduler ? std::max(scheduler->config().workerThread.count, 1) : 1;
+		const double perTask = std::max(profile.nsPerEntity, 1e-3);
+		uint32_t slice = (uint32_t)std::max(targetTaskNs / perTask, 1.0);
+		// Leave every worker something to do.
+		slice = std::min(slice, std::max((entityCount + workers - 1) / workers, 1u));
+		profile.slice = (int)slice;
+	}
+}
@@ -0,0 +1,34 @@
+#include "ECS/EntityLookup.h"
+#include <algorithm>
+#include <functional>
+
+namespace sakura::task_system::ecs
+{
+	void entity_lookup::resolve(sakura::ecs::world& ctx, gsl::span<const sakura::ecs::entity> ents)
+	{
+		clear();
+		// One walk of the entity table, runs of neighbouring slots come back as one slice.
+		uint32_t order = 0;
+		for (auto slice : ctx.batch(ents.data(), (uint32_t)ents.size()))
+			for (uint32_t i = 0; i < slice.count; ++i)
+				resolved.push_back({ slice.c, slice.start + i, order++ });
+		std::sort(resolved.begin(), resolved.end(), [](const location& a, const location& b)
+		{
+			if (a.c != b.c)
+				return std::less<const sakura::ecs::chunk*>()(a.c, b.c);
+			return a.index != b.index ? a.index < b.index : a.order < b.order;
+		});
+		for (uint32_t i = 0; i < (uint32_t)resolved.size(); ++i)
+		{
+			if (chunkGroups.empty() || chunkGroups.back().c != resolved[i].c)
+				chunkGroups.push_back({ resolved[i].c, i, i });
+			chunkGroups.back().end = i + 1;
+		}
+	}
+
+	void entity_lookup::clear()
+	{
+		resolved.clear();
+		chunkGroups.clear();
+	}
+}
@@ -0,0 +1,47 @@
+#include "ECS/FrameScratch.h"
+#include "TaskSystem/TaskSystem.h"
+
+namespace sakura::task_system::ecs
+{
+	frame_scratch::frame_scratch(size_t blockSize)
+		:blockSize(blockSize)
+	{
+
+	}
+
+	sakura::scratch_arena& frame_scratch::local()
+	{
+		return arenas.local(blockSize);
+	}
+
+	void frame_scratch::reset()
+	{
+		arenas.for_each([](uint32_t, sakura::scratch_arena& arena) { arena.reset(); });
+	}
+
+	sakura::vector<size_t> frame_scratch::high_water() const
+	{
+		sakura::vector<size_t> peaks;
+		arenas.for_each([&](uint32_t index, const sakura::scratch_arena& arena)
+		{
+			if (peaks.size() <= index)
+				peaks.resize(index + 1, 0);
+			peaks[index] = arena.peak();
+		});
+		return peaks;
+	}
+
+	size_t frame_scratch::capacity() const
+	{
+		size_t total = 0;
+		arenas.for_each([&](uint32_t, const sakura::scratch_arena& arena) { total += arena.capacity(); });
+		return total;
+	}
+
+	size_t frame_scratch::heap_allocations() const
+	{
+		size_t total = 0;
+		arenas.for_each([&](uint32_t, const sakura::scratch_arena& arena) { total += arena.heap_allocations(); });
+		return total;
+	}
+}
@@ -0,0 +1,251 @@
+#include "ECS/Hierarchy.h"
+#include "ECS/EntityLookup.h"
+#include "Math/Math.hpp"
+#include <algorithm>
+#include <cstring>
+#if defined(_MSC_VER)
+#include <xmmintrin.h>
+#define SAKURA_PREFETCH(p) _mm_prefetch(reinterpret_cast<const char*>(p), _MM_HINT_T0)
+#else
+#define SAKURA_PREFETCH(p) __builtin_prefetch(p)
+#endif
+
+namespace sakura::task_system::ecs
+{
+	using sakura::ecs::entity;
+
+	hierarchy_levels::hierarchy_levels(sakura::ecs::index_t parentType, sakura::ecs::index_t localToWorldType,
+		sakura::ecs::index_t localToParentType)
+		:parentType(parentType), localToWorldType(localToWorldType), localToParentType(localToParentType)
+	{
+
+	}
+
+	namespace
+	{
+		bool same_slice(const sakura::ecs::chunk_slice& a, const sakura::ecs::chunk_slice& b)
+		{
+			return a.c == b.c && a.start == b.start && a.count == b.count;
+		}
+
+		// Ids are recycled, an entity is only known by its id and version together.
+		uint64_t key_of(const entity& e)
+		{
+			return (uint64_t)e.id << 32 | (uint64_t)e.version;
+		}
+
+		// One frame behind, so that Parent writes later in this frame are still seen.
+		size_t check_timestamp(pipeline& pipeline)
+		{
+			const size_t now = pipeline.get_timestamp();
+			return now > 0 ? now - 1 : 0;
+		}
+	}
+
+	bool hierarchy_levels::unchanged(pipeline& pipeline, sakura::ecs::pass& pass, const sakura::ecs::chunk_vector<sakura::ecs::task>& tasks)
+	{
+		auto& ctx = pipeline.ctx;
+		if (tasks.size != childSlices.size())
+			return false;
+		for (uint32_t i = 0; i < (uint32_t)tasks.size; ++i)
+			if (!same_slice(childSlices[i], tasks[i].slice))
+				return false;
+		// Same chunks and counts. Entities are only compared in the chunks whose Parent
+		// column was stamped since the last check, in the same chunk order as tasks.
+		const auto filter = pass.filter.chunkFilter;
+		pass.filter.chunkFilter = { sakura::ecs::typeset{ &parentType, 1 }, checkedAt };
+		auto stamped = pipeline.create_tasks(pass, -1);
+		pass.filter.chunkFilter = filter;
+		size_t offset = 0;
+		uint32_t next = 0;
+		for (uint32_t i = 0; i < (uint32_t)tasks.size && next < (uint32_t)stamped.size; ++i)
+		{
+			const auto& tk = tasks[i];
+			if (stamped[next].slice.c == tk.slice.c)
+			{
+				next++;
+				const entity* ents = ctx.get_entities(tk.slice.c) + tk.slice.start;
+				if (std::memcmp(ents, childEntities.data() + offset, sizeof(entity) * tk.slice.count) != 0)
+					return false;
+			}
+			offset += tk.slice.count;
+		}
+		const uint64_t version = structural_version(ctx);
+		if (stamped.size > 0 || version != rootsVersion)
+		{
+			for (const auto& root : roots)
+				if (!ctx.exist(root))
+					return false;
+			uint32_t slice = 0;
+			for (auto rootSlice : ctx.batch(roots.data(), (uint32_t)roots.size()))
+				if (slice == rootSlices.size() || !same_slice(rootSlices[slice++], rootSlice))
+					return false;
+			if (slice != rootSlices.size())
+				return false;
+			rootsVersion = version;
+		}
+		checkedAt = check_timestamp(pipeline);
+		return true;
+	}
+
+	void hierarchy_levels::refresh(pipeline& pipeline, sakura::ecs::pass& pass)
+	{
+		auto& ctx = pipeline.ctx;
+		auto tasks = pipeline.create_tasks(pass, -1);
+		if (built && unchanged(pipeline, pass, tasks))
+			return;
+		checkedAt = check_timestamp(pipeline);
+		rootsVersion = structural_version(ctx);
+		// Children in chunk order, their own columns are read in place.
+		struct child
+		{
+			float4x4* localToWorld;
+			const float4x4* localToParent;
+			entity parent;
+		};
+		sakura::vector<child> children;
+		sakura::unordered_map<uint64_t, uint32_t> indices;
+		childSlices.clear();
+		childEntities.clear();
+		for (auto& tk : tasks)
+		{
+			const auto c = tk.slice.c;
+			const entity* ents = ctx.get_entities(c) + tk.slice.start;
+			childSlices.push_back(tk.slice);
+			childEntities.insert(childEntities.end(), ents, ents + tk.slice.count);
+			const auto parents = static_cast<const entity*>(ctx.get_owned_ro(c, parentType)) + tk.slice.start;
+			const auto l2ws = static_cast<float4x4*>(ctx.get_owned_rw(c, localToWorldType)) + tk.slice.start;
+			const auto l2ps = static_cast<const float4x4*>(ctx.get_owned_ro(c, localToParentType)) + tk.slice.start;
+			for (uint32_t i = 0; i < tk.slice.count; ++i)
+			{
+				indices.emplace(key_of(ents[i]), (uint32_t)children.size());
+				children.push_back({ l2ws + i, l2ps + i, parents[i] });
+			}
+		}
+		// Parents outside the indexed children are roots. Depths follow the parent
+		// links between children, memoized by index, without touching the world.
+		constexpr uint32_t Unknown = ~0u;
+		const auto parent_index = [&](uint32_t i)
+		{
+			const auto found = indices.find(key_of(children[i].parent));
+			return found == indices.end() ? Unknown : found->second;
+		};
+		sakura::vector<uint32_t> depths(children.size(), Unknown);
+		// Children on a Parent cycle, or below one, are not propagated.
+		sakura::vector<bool> detached(children.size(), false);
+		sakura::vector<uint32_t> chain;
+		uint32_t maxDepth = 0;
+		size_t cyclic = 0;
+		for (uint32_t i = 0; i < (uint32_t)children.size(); ++i)
+		{
+			// Walk up to a root or to an ancestor whose depth is known, then fill the chain down.
+			uint32_t depth = 0;
+			bool cycle = false;
+			chain.clear();
+			for (uint32_t cursor = i; cursor != Unknown;)
+			{
+				if (depths[cursor] != Unknown)
+				{
+					depth = depths[cursor] + 1;
+					cycle = detached[cursor];
+					break;
+				}
+				// A chain longer than the number of children went around a cycle.
+				if (chain.size() == children.size())
+				{
+					cycle = true;
+					break;
+				}
+				chain.push_back(cursor);
+				cursor = parent_index(cursor);
+			}
+			if (cycle)
+			{
+				maxDepth = std::max(maxDepth, 1u);
+				for (auto c : chain)
+				{
+					cyclic += depths[c] == Unknown;
+					depths[c] = 0;
+					detached[c] = true;
+				}
+				continue;
+			}
+			for (auto it = chain.rbegin(); it != chain.rend(); ++it)
+				depths[*it] = depth++;
+			maxDepth = std::max(maxDepth, depth);
+		}
+		if (cyclic > 0)
+			sakura::error("hierarchy_levels: {} entities are on or below a Parent cycle, they are not propagated!", cyclic);
+		// LocalToWorld of the roots, resolved in one batch and read chunk by chunk.
+		// Dead parents (destroyed, or an id recycled since) have nothing to read.
+		roots.clear();
+		for (uint32_t i = 0; i < (uint32_t)children.size(); ++i)
+			if (!detached[i] && parent_index(i) == Unknown && ctx.exist(children[i].parent))
+				roots.push_back(children[i].parent);
+		std::sort(roots.begin(), roots.end(), [](const entity& a, const entity& b) { return key_of(a) < key_of(b); });
+		roots.erase(std::unique(roots.begin(), roots.end(), [](const entity& a, const entity& b) { return key_of(a) == key_of(b); }), roots.end());
+		rootSlices.clear();
+		for (auto rootSlice : ctx.batch(roots.data(), (uint32_t)roots.size()))
+			rootSlices.push_back(rootSlice);
+		entity_lookup lookup;
+		lookup.resolve(ctx, { roots.data(), roots.size() });
+		sakura::unordered_map<uint64_t, const float4x4*> rootToWorlds;
+		rootToWorlds.reserve(roots.size());
+		for_each_ro<float4x4>(ctx, lookup, localToWorldType, [&](const entity_lookup::location& l, const float4x4* l2w)
+		{
+			rootToWorlds.emplace(key_of(roots[l.order]), l2w);
+		});
+		// Counting sort by depth keeps the chunk order inside every level.
+		levelOffsets.assign(maxDepth + 1, 0);
+		for (uint32_t d : depths)
+			levelOffsets[d + 1]++;
+		for (size_t d = 1; d < levelOffsets.size(); ++d)
+			levelOffsets[d] += levelOffsets[d - 1];
+		sakura::vector<uint32_t> cursors(levelOffsets.begin(), levelOffsets.end() - 1);
+		nodes.assign(children.size(), node{});
+		for (uint32_t i = 0; i < (uint32_t)children.size(); ++i)
+		{
+			node& n = nodes[cursors[depths[i]]++];
+			n.localToWorld = children[i].localToWorld;
+			n.localToParent = children[i].localToParent;
+			if (detached[i])
+				continue;
+			const uint32_t parent = parent_index(i);
+			if (parent != Unknown)
+				n.parentToWorld = children[parent].localToWorld;
+			else if (const auto root = rootToWorlds.find(key_of(children[i].parent)); root != rootToWorlds.end())
+				n.parentToWorld = root->second;
+		}
+		built = true;
+	}
+
+	void hierarchy_levels::propagate() const
+	{
+		const auto solve = [this](uint32_t i)
+		{
+			// Levels are laid out contiguously, so the nodes ahead are the next ones to run.
+			constexpr uint32_t PrefetchDistance = 8;
+			if (i + PrefetchDistance < nodes.size())
+			{
+				const node& ahead = nodes[i + PrefetchDistance];
+				SAKURA_PREFETCH(ahead.localToParent);
+				SAKURA_PREFETCH(ahead.parentToWorld);
+			}
+			const node& n = nodes[i];
+			if (n.localToWorld && n.localToParent && n.parentToWorld)
+				*n.localToWorld = sakura::math::multiply(*n.parentToWorld, *n.localToParent);
+		};
+		for (uint32_t d = 0; d < depth(); ++d)
+		{
+			const uint32_t begin = levelOffsets[d];
+			const uint32_t count = levelOffsets[d + 1] - begin;
+			if (count < parallelThreshold)
+			{
+				for (uint32_t i = begin; i < begin + count; ++i)
+					solve(i);
+				continue;
+			}
+			task_system::parallel_for(count, grain, [&](uint32_t i) { solve(begin + i); });
+		}
+	}
+}
@@ -0,0 +1,88 @@
+#include "ECS/RandomWrites.h"
+#include <algorithm>
+#include <cstring>
+
+namespace sakura::task_system::ecs
+{
+	struct random_writes::worker_buffer
+	{
+		struct entry
+		{
+			sakura::ecs::entity e;
+			sakura::ecs::index_t type;
+			uint32_t size;
+			uint32_t offset;
+		};
+		// Consecutive writes of one task.
+		struct segment
+		{
+			uint32_t task;
+			uint32_t begin;
+			uint32_t end;
+		};
+		sakura::vector<uint8_t> bytes;
+		sakura::vector<entry> entries;
+		sakura::vector<segment> segments;
+
+		void clear()
+		{
+			bytes.clear();
+			entries.clear();
+			segments.clear();
+		}
+	};
+
+	random_writes::random_writes(sakura::ecs::world& ctx)
+		:ctx(ctx)
+	{
+
+	}
+
+	random_writes::~random_writes() = default;
+
+	void random_writes::write(const sakura::ecs::task& tk, sakura::ecs::entity e, sakura::ecs::index_t type, const void* data, uint32_t size)
+	{
+		auto& buffer = buffers.local();
+		// Tasks are keyed by their first entity in the pass, which follows task order.
+		const uint32_t task = tk.indexInKernel;
+		const uint32_t entry = (uint32_t)buffer.entries.size();
+		if (buffer.segments.empty() || buffer.segments.back().task != task)
+			buffer.segments.push_back({ task, entry, entry });
+		buffer.segments.back().end = entry + 1;
+		const uint32_t offset = (uint32_t)buffer.bytes.size();
+		buffer.bytes.resize(offset + size);
+		std::memcpy(buffer.bytes.data() + offset, data, size);
+		buffer.entries.push_back({ e, type, size, offset });
+	}
+
+	void random_writes::apply()
+	{
+		order.clear();
+		buffers.for_each([&](uint32_t, worker_buffer& buffer)
+		{
+			for (uint32_t i = 0; i < (uint32_t)buffer.segments.size(); ++i)
+				order.push_back({ buffer.segments[i].task, &buffer, i });
+		});
+		// All segments of one task are in one buffer, their index keeps them in record order.
+		std::sort(order.begin(), order.end(), [](const segment_ref& a, const segment_ref& b)
+		{
+			return a.task != b.task ? a.task < b.task : a.segment < b.segment;
+		});
+		uint32_t applied = 0;
+		for (const auto& ref : order)
+		{
+			const auto& segment = ref.buffer->segments[ref.segment];
+			for (uint32_t i = segment.begin; i < segment.end; ++i)
+			{
+				const auto& entry = ref.buffer->entries[i];
+				if (auto dst = ctx.get_owned_rw(entry.e, entry.type))
+				{
+					std::memcpy(dst, ref.buffer->bytes.data() + entry.offset, entry.size);
+					applied++;
+				}
+			}
+		}
+		buffers.for_each([](uint32_t, worker_buffer& buffer) { buffer.clear(); });
+		lastApplied = applied;
+	}
+}
@@ -0,0 +1,331 @@
+#include "ECS/Snapshot.h"
+#include "ECS/Spawn.h"
+#include <algorithm>
+
+namespace sakura::task_system::ecs
+{
+	namespace
+	{
+		using sakura::ecs::index_t;
+
+		constexpr uint32_t SnapshotMagic = 0x4E534B53; // "SKSN"
+		constexpr uint32_t SnapshotVersion = 1;
+		// Group masks have one bit per component.
+		constexpr size_t MaxComponents = 64;
+		// Columns start on cache line boundaries, relative to the start of the file.
+		constexpr uint64_t ColumnAlignment = 64;
+
+		// Layout: header, component table, group table, then the columns of every
+		// group. The columns of a group follow each other from its offset, in
+		// component table order, each one aligned to ColumnAlignment.
+		struct file_header
+		{
+			uint32_t magic;
+			uint32_t version;
+			uint32_t componentCount;
+			uint32_t groupCount;
+		};
+
+		struct file_component
+		{
+			uint8_t guid[16];
+			uint32_t size;
+			uint32_t padding;
+		};
+
+		struct file_group
+		{
+			uint64_t mask;
+			uint64_t offset;
+			uint32_t count;
+			uint32_t padding;
+		};
+
+		uint64_t align_column(uint64_t offset)
+		{
+			return (offset + ColumnAlignment - 1) & ~(ColumnAlignment - 1);
+		}
+
+		sakura::ecs::entity_type as_type(const sakura::vector<index_t>& types)
+		{
+			using types_length_t = decltype(sakura::ecs::typeset::length);
+			return { sakura::ecs::typeset{ types.data(), (types_length_t)types.size() }, sakura::ecs::metaset{} };
+		}
+
+		// Components every archetype may carry that a snapshot never needs.
+		bool builtin(index_t type)
+		{
+			return type == core::database::group_id || type == core::database::disable_id ||
+				type == core::database::cleanup_id || type == core::database::mask_id;
+		}
+
+		template<class F>
+		void for_each_bit(uint64_t mask, F&& f)
+		{
+			for (uint32_t i = 0; mask != 0; ++i, mask >>= 1)
+				if (mask & 1)
+					f(i);
+		}
+	}
+
+	bool save_snapshot(sakura::ecs::world& ctx, const sakura::vfs::path& path,
+		gsl::span<const snapshot_component> components, snapshot_stats* stats)
+	{
+		if ((size_t)components.size() > MaxComponents)
+		{
+			sakura::error("save_snapshot: at most {} components can be stored, {} given!", MaxComponents, components.size());
+			return false;
+		}
+		// Every chunk owning any of the components, in the world's chunk order.
+		sakura::vector<index_t> types;
+		for (const auto& component : components)
+			types.push_back(component.type);
+		std::sort(types.begin(), types.end());
+		sakura::ecs::filters filter;
+		filter.archetypeFilter = { {}, as_type(types), {} };
+		pipeline ppl(ctx);
+		auto pass = ppl.create_pass(filter, boost::hana::make_tuple());
+		auto tasks = ppl.create_tasks(*pass, -1);
+
+		struct group
+		{
+			uint64_t mask;
+			uint32_t count;
+			sakura::vector<sakura::ecs::chunk_slice> slices;
+		};
+		sakura::vector<group> groups;
+		// Owned components of the saved entities that are not listed, and archetypes
+		// carrying metatypes (shared components among them): neither is stored.
+		sakura::vector<index_t> dropped;
+		uint32_t metatypedEntities = 0;
+		const sakura::ecs::chunk* lastChunk = nullptr;
+		bool metatyped = false;
+		for (auto& tk : tasks)
+		{
+			if (tk.slice.c != lastChunk)
+			{
+				lastChunk = tk.slice.c;
+				const auto type = ctx.get_type(ctx.get_entities(tk.slice.c)[tk.slice.start]);
+				for (uint32_t i = 0; i < (uint32_t)type.types.length; ++i)
+				{
+					const index_t t = type.types.data[i];
+					if (!builtin(t) && !std::binary_search(types.begin(), types.end(), t) &&
+						std::find(dropped.begin(), dropped.end(), t) == dropped.end())
+						dropped.push_back(t);
+				}
+				metatyped = type.metatypes.length > 0;
+			}
+			if (metatyped)
+				metatypedEntities += tk.slice.count;
+			uint64_t mask = 0;
+			for (size_t i = 0; i < (size_t)components.size(); ++i)
+				if (ctx.get_owned_ro(tk.slice.c, components[i].type))
+					mask |= 1ull << i;
+			auto target = std::find_if(groups.begin(), groups.end(), [mask](const group& g) { return g.mask == mask; });
+			if (target == groups.end())
+				target = groups.insert(groups.end(), group{ mask, 0, {} });
+			target->count += tk.slice.count;
+			target->slices.push_back(tk.slice);
+		}
+
+		const file_header header{ SnapshotMagic, SnapshotVersion, (uint32_t)components.size(), (uint32_t)groups.size() };
+		sakura::vector<file_component> fileComponents(components.size());
+		for (size_t i = 0; i < fileComponents.size(); ++i)
+		{
+			std::memcpy(fileComponents[i].guid, components[i].guid.data(), sizeof(fileComponents[i].guid));
+			fileComponents[i].size = components[i].size;
+			fileComponents[i].padding = 0;
+		}
+		sakura::vector<file_group> fileGroups;
+		uint64_t offset = align_column(sizeof(file_header) + sizeof(file_component) * fileComponents.size()
+			+ sizeof(file_group) * groups.size());
+		for (const auto& g : groups)
+		{
+			fileGroups.push_back({ g.mask, offset, g.count, 0 });
+			for_each_bit(g.mask, [&](uint32_t i) { offset = align_column(offset + (uint64_t)g.count * components[i].size); });
+		}
+
+		std::unique_ptr<sakura::vfs::file> file(sakura::vfs::try_open_file(path, "wb", true));
+		if (!file || !file->valid())
+		{
+			sakura::error("save_snapshot: failed to open {} for writing!", path);
+			return false;
+		}
+		uint64_t position = 0;
+		bool written = true;
+		const auto write = [&](const void* data, uint64_t size)
+		{
+			written = written && file->write(data, 1, (size_t)size) == size;
+			position += size;
+		};
+		const auto pad_column = [&]
+		{
+			static const uint8_t zeros[ColumnAlignment] = {};
+			write(zeros, align_column(position) - position);
+		};
+		write(&header, sizeof(header));
+		write(fileComponents.data(), sizeof(file_component) * fileComponents.size());
+		write(fileGroups.data(), sizeof(file_group) * fileGroups.size());
+		for (const auto& g : groups)
+		{
+			for_each_bit(g.mask, [&](uint32_t i)
+			{
+				pad_column();
+				const auto& component = components[i];
+				for (const auto& slice : g.slices)
+				{
+					const auto column = static_cast<const uint8_t*>(ctx.get_owned_ro(slice.c, component.type));
+					write(column + (size_t)slice.start * component.size, (uint64_t)slice.count * component.size);
+				}
+			});
+		}
+		if (!written)
+		{
+			sakura::error("save_snapshot: failed to write {}!", path);
+			return false;
+		}
+		if (!dropped.empty())
+			sakura::warn("save_snapshot: {} components owned by the saved entities are not listed and not stored in {}!",
+				dropped.size(), path);
+		if (metatypedEntities > 0)
+			sakura::warn("save_snapshot: the metatypes (shared components included) of {} saved entities are not stored in {}!",
+				metatypedEntities, path);
+		if (stats)
+		{
+			*stats = {};
+			stats->droppedComponents = (uint32_t)dropped.size();
+			stats->droppedMetatypes = metatypedEntities;
+			stats->groups = (uint32_t)groups.size();
+			for (const auto& g : groups)
+				stats->entities += g.count;
+			stats->bytes = position;
+		}
+		return true;
+	}
+
+	bool load_snapshot(sakura::ecs::world& ctx, const sakura::vfs::path& path,
+		gsl::span<const snapshot_component> components, snapshot_stats* stats)
+	{
+		std::unique_ptr<sakura::vfs::mapped_file> file(sakura::vfs::try_map_file(path));
+		if (!file || !file->valid())
+		{
+			sakura::error("load_snapshot: failed to map {}!", path);
+			return false;
+		}
+		const auto bytes = static_cast<const uint8_t*>(file->data());
+		const uint64_t size = file->size();
+		const auto corrupted = [&]
+		{
+			sakura::error("load_snapshot: {} is not a valid snapshot!", path);
+			return false;
+		};
+		file_header header;
+		if (size < sizeof(header))
+			return corrupted();
+		std::memcpy(&header, bytes, sizeof(header));
+		if (header.magic != SnapshotMagic || header.version != SnapshotVersion || header.componentCount > MaxComponents)
+			return corrupted();
+		if (size < sizeof(file_header) + sizeof(file_component) * header.componentCount
+			+ sizeof(file_group) * (uint64_t)header.groupCount)
+			return corrupted();
+		const auto fileComponents = reinterpret_cast<const file_component*>(bytes + sizeof(file_header));
+		const auto fileGroups = reinterpret_cast<const file_group*>(fileComponents + header.componentCount);
+
+		// Index in components of every stored component, -1 if it is not loaded.
+		int matched[MaxComponents];
+		for (uint32_t i = 0; i < header.componentCount; ++i)
+		{
+			matched[i] = -1;
+			for (size_t j = 0; j < (size_t)components.size(); ++j)
+			{
+				if (std::memcmp(fileComponents[i].guid, components[j].guid.data(), sizeof(fileComponents[i].guid)) != 0)
+					continue;
+				if (fileComponents[i].size != components[j].size)
+				{
+					sakura::error("load_snapshot: component {} of {} is {} bytes, {} bytes stored!",
+						j, path, components[j].size, fileComponents[i].size);
+					return false;
+				}
+				matched[i] = (int)j;
+			}
+		}
+		uint32_t skipped = 0;
+		for (uint32_t i = 0; i < header.componentCount; ++i)
+			skipped += matched[i] < 0;
+		// Everything is checked before the first allocation, a bad file leaves the world untouched.
+		for (uint32_t g = 0; g < header.groupCount; ++g)
+		{
+			const auto& fileGroup = fileGroups[g];
+			if (header.componentCount < 64 && (fileGroup.mask >> header.componentCount) != 0)
+				return corrupted();
+			uint64_t offset = fileGroup.offset;
+			bool inside = true;
+			for_each_bit(fileGroup.mask, [&](uint32_t i)
+			{
+				const uint64_t end = offset + (uint64_t)fileGroup.count * fileComponents[i].size;
+				inside = inside && end >= offset && end <= size;
+				offset = align_column(end);
+			});
+			if (!inside)
+				return corrupted();
+		}
+
+		struct column
+		{
+			const uint8_t* data;
+			index_t type;
+			uint32_t size;
+		};
+		snapshot_stats loaded;
+		sakura::vector<column> columns;
+		sakura::vector<index_t> types;
+		sakura::vector<uint32_t> firsts;
+		for (uint32_t g = 0; g < header.groupCount; ++g)
+		{
+			const auto& fileGroup = fileGroups[g];
+			columns.clear();
+			types.clear();
+			uint64_t offset = fileGroup.offset;
+			for_each_bit(fileGroup.mask, [&](uint32_t i)
+			{
+				if (matched[i] >= 0)
+				{
+					const auto& component = components[matched[i]];
+					columns.push_back({ bytes + offset, component.type, component.size });
+					types.push_back(component.type);
+				}
+				offset = align_column(offset + (uint64_t)fileGroup.count * fileComponents[i].size);
+			});
+			if (columns.empty() || fileGroup.count == 0)
+				continue;
+			std::sort(types.begin(), types.end());
+			const auto slices = spawn_reserve(ctx, as_type(types), fileGroup.count);
+			// Position of every slice in the stored columns.
+			firsts.resize(slices.size());
+			uint32_t first = 0;
+			for (size_t i = 0; i < slices.size(); ++i)
+			{
+				firsts[i] = first;
+				first += slices[i].count;
+			}
+			spawn_initialize(slices, [&](const sakura::ecs::chunk_slice& slice, uint32_t index)
+			{
+				for (const auto& col : columns)
+				{
+					const auto dst = static_cast<uint8_t*>(ctx.get_owned_rw(slice.c, col.type)) + (size_t)slice.start * col.size;
+					std::memcpy(dst, col.data + (size_t)firsts[index] * col.size, (size_t)slice.count * col.size);
+				}
+			});
+			loaded.groups++;
+			loaded.entities += fileGroup.count;
+			for (const auto& col : columns)
+				loaded.bytes += (uint64_t)fileGroup.count * col.size;
+		}
+		if (skipped > 0)
+			sakura::warn("load_snapshot: {} components stored in {} are not listed and not loaded!", skipped, path);
+		loaded.droppedComponents = skipped;
+		if (stats)
+			*stats = loaded;
+		return true;
+	}
+}
@@ -0,0 +1,228 @@
+#include "ECS/ECS.h"
+#include <algorithm>
+#include <cstdio>
+
+namespace sakura::task_system::ecs
+{
+	void pipeline_timeline::begin_frame()
+	{
+		logs.for_each([](uint32_t, worker_log& log)
+		{
+			log.events.clear();
+			log.tasks.clear();
+		});
+		origin = clock::now();
+	}
+
+	void pipeline_timeline::pass_named(uint32_t passIndex, const char* name)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (recorded.size() <= passIndex)
+			recorded.resize(passIndex + 1);
+		recorded[passIndex].name = name;
+	}
+
+	void pipeline_timeline::pass_dependencies(uint32_t passIndex, gsl::span<const uint32_t> dependencies)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (recorded.size() <= passIndex)
+			recorded.resize(passIndex + 1);
+		recorded[passIndex].dependencies.assign(dependencies.begin(), dependencies.end());
+	}
+
+	void pipeline_timeline::pass_ready(uint32_t passIndex)
+	{
+		record(pass_event::ready, passIndex, now());
+	}
+
+	void pipeline_timeline::pass_start(uint32_t passIndex)
+	{
+		record(pass_event::start, passIndex, now());
+	}
+
+	void pipeline_timeline::pass_finish(uint32_t passIndex)
+	{
+		record(pass_event::finish, passIndex, now());
+	}
+
+	void pipeline_timeline::pass_fused(uint32_t passIndex, uint32_t head)
+	{
+		record(pass_event::fused, passIndex, head);
+	}
+
+	void pipeline_timeline::pass_schedule(uint32_t passIndex, uint64_t scheduleNs)
+	{
+		record(pass_event::schedule, passIndex, (int64_t)scheduleNs);
+	}
+
+	void pipeline_timeline::task(uint32_t passIndex, int64_t startNs, int64_t finishNs)
+	{
+		logs.local().tasks.push_back({ passIndex, 0, startNs, finishNs });
+	}
+
+	sakura::vector<pass_timing> pipeline_timeline::passes() const
+	{
+		sakura::vector<pass_timing> passes;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			passes.assign(recorded.begin(), recorded.end());
+		}
+		auto at = [&](uint32_t passIndex) -> pass_timing&
+		{
+			if (passes.size() <= passIndex)
+				passes.resize(passIndex + 1);
+			return passes[passIndex];
+		};
+		sakura::vector<std::pair<uint32_t, uint32_t>> fused;
+		logs.for_each([&](uint32_t worker, const worker_log& log)
+		{
+			for (const auto& event : log.events)
+			{
+				auto& pass = at(event.passIndex);
+				switch (event.kind)
+				{
+				case pass_event::ready: pass.readyNs = event.value; break;
+				case pass_event::start: pass.startNs = event.value; pass.worker = worker; break;
+				case pass_event::finish: pass.finishNs = event.value; break;
+				case pass_event::schedule: pass.scheduleNs = event.value; break;
+				case pass_event::fused: fused.emplace_back(event.passIndex, (uint32_t)event.value); break;
+				}
+			}
+		});
+		// Once every head is complete.
+		for (const auto& [passIndex, head] : fused)
+		{
+			const auto timing = at(head);
+			auto& pass = at(passIndex);
+			pass.readyNs = timing.readyNs;
+			pass.startNs = timing.startNs;
+			pass.finishNs = timing.finishNs;
+			pass.worker = timing.worker;
+		}
+		return passes;
+	}
+
+	sakura::vector<task_timing> pipeline_timeline::tasks() const
+	{
+		sakura::vector<task_timing> tasks;
+		logs.for_each([&](uint32_t worker, const worker_log& log)
+		{
+			for (auto task : log.tasks)
+			{
+				task.worker = worker;
+				tasks.push_back(task);
+			}
+		});
+		std::sort(tasks.begin(), tasks.end(), [](const task_timing& a, const task_timing& b) { return a.startNs < b.startNs; });
+		return tasks;
+	}
+
+	sakura::vector<uint32_t> pipeline_timeline::critical_path() const
+	{
+		return critical_path(passes());
+	}
+
+	sakura::vector<uint32_t> pipeline_timeline::critical_path(const sakura::vector<pass_timing>& passes)
+	{
+		sakura::vector<uint32_t> path;
+		int64_t last = -1;
+		uint32_t current = 0;
+		for (uint32_t i = 0; i < (uint32_t)passes.size(); ++i)
+			if (passes[i].finishNs > last)
+			{
+				last = passes[i].finishNs;
+				current = i;
+			}
+		if (last < 0)
+			return path;
+		while (true)
+		{
+			path.push_back(current);
+			int64_t latest = -1;
+			uint32_t next = current;
+			for (auto dependency : passes[current].dependencies)
+				if (dependency < passes.size() && passes[dependency].finishNs > latest)
+				{
+					latest = passes[dependency].finishNs;
+					next = dependency;
+				}
+			if (latest < 0)
+				break;
+			current = next;
+		}
+		std::reverse(path.begin(), path.end());
+		return path;
+	}
+
+	namespace
+	{
+		std::string pass_name(const pass_timing& pass, uint32_t passIndex)
+		{
+			if (!pass.name)
+				return fmt::format("pass {}", passIndex);
+			std::string name;
+			for (const char* c = pass.name; *c; ++c)
+			{
+				if (*c == '"' || *c == '\\')
+					name.push_back('\\');
+				name.push_back(*c);
+			}
+			return name;
+		}
+	}
+
+	std::string pipeline_timeline::chrome_trace() const
+	{
+		const auto passes = this->passes();
+		const auto tasks = this->tasks();
+		const auto path = critical_path(passes);
+		// Timestamps are microseconds in the trace event format.
+		auto us = [](int64_t ns) { return ns / 1000.0; };
+		std::string json = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+		json += "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"Passes\"}},";
+		json += "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"Tasks\"}},";
+		json += "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":2,\"args\":{\"name\":\"Critical Path\"}}";
+		for (uint32_t i = 0; i < (uint32_t)passes.size(); ++i)
+		{
+			const auto& pass = passes[i];
+			if (pass.startNs < 0 || pass.finishNs < 0)
+				continue;
+			json += fmt::format(
+				",{{\"name\":\"{}\",\"cat\":\"pass\",\"ph\":\"X\",\"pid\":0,\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f},"
+				"\"args\":{{\"pass\":{},\"ready_us\":{:.3f},\"dispatch_delay_us\":{:.3f},\"schedule_us\":{:.3f}}}}}",
+				pass_name(pass, i), pass.worker, us(pass.startNs), us(pass.finishNs - pass.startNs),
+				i, us(pass.readyNs), us(pass.startNs - pass.readyNs), us(pass.scheduleNs));
+		}
+		for (const auto& task : tasks)
+		{
+			json += fmt::format(
+				",{{\"name\":\"{}\",\"cat\":\"task\",\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f}}}",
+				pass_name(passes[task.passIndex], task.passIndex), task.worker,
+				us(task.startNs), us(task.finishNs - task.startNs));
+		}
+		for (auto i : path)
+		{
+			const auto& pass = passes[i];
+			// Waiting time is drawn from readiness so gaps on the path are visible.
+			json += fmt::format(
+				",{{\"name\":\"{}\",\"cat\":\"critical\",\"ph\":\"X\",\"pid\":2,\"tid\":0,\"ts\":{:.3f},\"dur\":{:.3f}}}",
+				pass_name(pass, i), us(pass.readyNs), us(pass.finishNs - pass.readyNs));
+		}
+		json += "]}";
+		return json;
+	}
+
+	bool pipeline_timeline::dump_chrome_trace(const char* path) const
+	{
+		const auto json = chrome_trace();
+		std::FILE* file = std::fopen(path, "wb");
+		if (!file)
+		{
+			sakura::error("pipeline_timeline: failed to open {} for writing!", path);
+			return false;
+		}
+		const bool written = std::fwrite(json.data(), 1, json.size(), file) == json.size();
+		std::fclose(file);
+		return written;
+	}
+}
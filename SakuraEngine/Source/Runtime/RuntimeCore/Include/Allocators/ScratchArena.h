@@ -0,0 +1,87 @@
+﻿/*
+ * @Description: Growable bump allocator for per-frame scratch memory.
+ * @FilePath: \allocators\ScratchArena.h
+ */
+#pragma once
+#include "AllocatorBase.h"
+#include <type_traits>
+
+namespace sakura
+{
+	// Bump allocator that chains a new block when the current one is full instead
+	// of failing. Memory is only given back by reset(), which also merges the chain
+	// into one block as large as everything used so far, so a steady workload stops
+	// allocating after its first frames. Not thread safe, meant to be owned by one worker.
+	class RuntimeCoreAPI scratch_arena : public allocator {
+	public:
+		static constexpr std::size_t DefaultBlockSize = 64 * 1024;
+		scratch_arena(const std::size_t blockSize = DefaultBlockSize);
+		scratch_arena(const scratch_arena&) = delete;
+		scratch_arena& operator=(const scratch_arena&) = delete;
+
+		virtual ~scratch_arena() override;
+
+		// alignment 0 means alignof(std::max_align_t).
+		virtual void* allocate(
+			const std::size_t size, const std::size_t alignment = 0) override;
+
+		// No-op, use reset().
+		virtual void free(void* ptr) override;
+
+		virtual void init() override;
+
+		// Invalidates everything allocated since the last reset.
+		void reset();
+
+		// Bytes handed out since the last reset, padding included.
+		std::size_t used() const { return m_used; }
+		// Highest used() seen since construction.
+		std::size_t peak() const { return m_peak; }
+		// Bytes reserved by the blocks.
+		std::size_t capacity() const { return m_totalSize; }
+		// Blocks chained since the last reset, 1 once the arena has settled.
+		std::size_t block_count() const { return m_blockCount; }
+		// Blocks taken from the heap since construction, merges by reset() included.
+		std::size_t heap_allocations() const { return m_heapAllocations; }
+	private:
+		struct block
+		{
+			block* next;
+			std::size_t size;
+		};
+		void grow(const std::size_t minSize);
+		void release();
+		block* m_head = nullptr;
+		std::size_t m_offset = 0;
+		std::size_t m_blockSize = 0;
+		std::size_t m_blockCount = 0;
+		std::size_t m_heapAllocations = 0;
+	};
+
+	// STL allocator over a scratch_arena. Deallocation is a no-op, the storage
+	// lives until the arena is reset.
+	template<class T>
+	struct arena_allocator
+	{
+		using value_type = T;
+		using propagate_on_container_move_assignment = std::true_type;
+		arena_allocator(scratch_arena& arena) noexcept
+			:arena(&arena) {}
+		template<class U>
+		arena_allocator(const arena_allocator<U>& other) noexcept
+			:arena(other.arena) {}
+
+		T* allocate(std::size_t n)
+		{
+			return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T)));
+		}
+		void deallocate(T*, std::size_t) noexcept {}
+
+		template<class U>
+		bool operator==(const arena_allocator<U>& other) const noexcept { return arena == other.arena; }
+		template<class U>
+		bool operator!=(const arena_allocator<U>& other) const noexcept { return arena != other.arena; }
+
+		scratch_arena* arena;
+	};
+}
@@ -0,0 +1,230 @@
+﻿#pragma once
+#include "SakuraSTL.hpp"
+#include "Math/Vector.h"
+#include "Math/Matrix.h"
+#include "Math/VectorMath.h"
+#include <cstring>
+
+// Structure-of-arrays views over AoS component arrays: Width consecutive
+// elements are transposed into registers of the __vector layer (one register
+// per component, one lane per element), processed together and transposed back.
+// Loads past the end of a partial group repeat the last element and stores
+// write only the valid lanes, so kernels can run whole groups up to the tail.
+namespace sakura::math::lanes
+{
+	using __vector::VectorRegister;
+	// Elements per group, the float width of VectorRegister.
+	constexpr uint32 Width = 4;
+
+	struct float3_lanes
+	{
+		VectorRegister x, y, z;
+	};
+	struct float4x4_lanes
+	{
+		// Element r * 4 + c holds row r, column c of every lane.
+		VectorRegister m[16];
+	};
+
+	// Calls f(first, count) for every group of at most Width elements in [0, size).
+	template<class F>
+	FORCEINLINE void for_each(const uint32 size, F&& f)
+	{
+		for (uint32 first = 0; first < size; first += Width)
+			f(first, std::min(Width, size - first));
+	}
+
+	FORCEINLINE VectorRegister splat(const float v)
+	{
+		return __vector::vector_register(v, v, v, v);
+	}
+
+	// Loads a float member of count elements laid out stride bytes apart.
+	FORCEINLINE VectorRegister load_float(const float* first, const uint32 count, const size_t stride = sizeof(float))
+	{
+		const char* base = reinterpret_cast<const char*>(first);
+		float v[Width];
+		for (uint32 i = 0; i < Width; ++i)
+			v[i] = *reinterpret_cast<const float*>(base + std::min(i, count - 1) * stride);
+		return __vector::vector_register(v[0], v[1], v[2], v[3]);
+	}
+
+	// Loads a Vector3f member of count elements laid out stride bytes apart.
+	// Full groups of a packed array take three loads and a transpose.
+	FORCEINLINE float3_lanes load_float3(const Vector3f* first, const uint32 count, const size_t stride = sizeof(Vector3f))
+	{
+		static_assert(sizeof(Vector3f) == sizeof(float) * 3, "lanes: Vector3f must be packed.");
+		if (count == Width && stride == sizeof(Vector3f))
+		{
+			// r0 = x0 y0 z0 x1, r1 = y1 z1 x2 y2, r2 = z2 x3 y3 z3
+			const float* f = first->data_view().data();
+			const VectorRegister r0 = __vector::load(sakura::span<const float, 4>(f, 4));
+			const VectorRegister r1 = __vector::load(sakura::span<const float, 4>(f + 4, 4));
+			const VectorRegister r2 = __vector::load(sakura::span<const float, 4>(f + 8, 4));
+			return {
+				__vector::permute<0, 1, 2, 5>(__vector::permute<0, 3, 6, 0>(r0, r1), r2),
+				__vector::permute<0, 1, 2, 6>(__vector::permute<1, 4, 7, 0>(r0, r1), r2),
+				__vector::permute<0, 1, 4, 7>(__vector::permute<2, 5, 0, 0>(r0, r1), r2)
+			};
+		}
+		const char* base = reinterpret_cast<const char*>(first);
+		float v[3][Width];
+		for (uint32 i = 0; i < Width; ++i)
+		{
+			const auto& e = *reinterpret_cast<const Vector3f*>(base + std::min(i, count - 1) * stride);
+			const auto data = e.data_view();
+			v[0][i] = data[0]; v[1][i] = data[1]; v[2][i] = data[2];
+		}
+		return {
+			__vector::vector_register(v[0][0], v[0][1], v[0][2], v[0][3]),
+			__vector::vector_register(v[1][0], v[1][1], v[1][2], v[1][3]),
+			__vector::vector_register(v[2][0], v[2][1], v[2][2], v[2][3])
+		};
+	}
+
+	// Stores the first count lanes into a packed Vector3f array.
+	FORCEINLINE void store_float3(Vector3f* first, const float3_lanes& v, const uint32 count)
+	{
+		const VectorRegister r0 = __vector::permute<0, 1, 4, 2>(__vector::permute<0, 4, 1, 0>(v.x, v.y), v.z);
+		const VectorRegister r1 = __vector::permute<0, 2, 6, 1>(__vector::permute<1, 2, 5, 6>(v.y, v.z), v.x);
+		const VectorRegister r2 = __vector::permute<0, 7, 2, 1>(__vector::permute<2, 3, 7, 0>(v.z, v.y), v.x);
+		float* f = first->data_view().data();
+		if (count == Width)
+		{
+			__vector::store(sakura::span<float, 4>(f, 4), r0);
+			__vector::store(sakura::span<float, 4>(f + 4, 4), r1);
+			__vector::store(sakura::span<float, 4>(f + 8, 4), r2);
+			return;
+		}
+		float packed[3 * Width];
+		__vector::store(sakura::span<float, 4>(packed, 4), r0);
+		__vector::store(sakura::span<float, 4>(packed + 4, 4), r1);
+		__vector::store(sakura::span<float, 4>(packed + 8, 4), r2);
+		std::memcpy(f, packed, sizeof(Vector3f) * count);
+	}
+
+	FORCEINLINE float3_lanes add(const float3_lanes& a, const float3_lanes& b)
+	{
+		return { __vector::add(a.x, b.x), __vector::add(a.y, b.y), __vector::add(a.z, b.z) };
+	}
+
+	FORCEINLINE float3_lanes subtract(const float3_lanes& a, const float3_lanes& b)
+	{
+		return { __vector::subtract(a.x, b.x), __vector::subtract(a.y, b.y), __vector::subtract(a.z, b.z) };
+	}
+
+	FORCEINLINE float3_lanes multiply(const float3_lanes& a, const VectorRegister s)
+	{
+		return { __vector::multiply(a.x, s), __vector::multiply(a.y, s), __vector::multiply(a.z, s) };
+	}
+
+	// a * s + b
+	FORCEINLINE float3_lanes multiply_add(const float3_lanes& a, const VectorRegister s, const float3_lanes& b)
+	{
+		return { __vector::multiply_add(a.x, s, b.x), __vector::multiply_add(a.y, s, b.y), __vector::multiply_add(a.z, s, b.z) };
+	}
+
+	FORCEINLINE VectorRegister dot_product(const float3_lanes& a, const float3_lanes& b)
+	{
+		return __vector::multiply_add(a.x, b.x, __vector::multiply_add(a.y, b.y, __vector::multiply(a.z, b.z)));
+	}
+
+	// Same contract as math::normalize: lanes not longer than tolerance become zero.
+	FORCEINLINE float3_lanes normalize(const float3_lanes& a, const float tolerance = SMALL_NUMBER)
+	{
+		const VectorRegister squareSum = dot_product(a, a);
+		const VectorRegister valid = __vector::greater(squareSum, splat(tolerance));
+		const VectorRegister scale = __vector::select(valid, __vector::reciprocal_sqrt(squareSum), __vector::register_zero);
+		return multiply(a, scale);
+	}
+
+	// Loads count packed matrices, one 4x4 transpose per row.
+	FORCEINLINE float4x4_lanes load_float4x4(const float4x4* first, const uint32 count)
+	{
+		float4x4_lanes res;
+		for (uint32 r = 0; r < 4; ++r)
+		{
+			VectorRegister rows[Width];
+			for (uint32 i = 0; i < Width; ++i)
+				rows[i] = __vector::load_aligned(sakura::span<const float, 4>(first[std::min(i, count - 1)].M[r], 4));
+			const VectorRegister t0 = __vector::permute<0, 4, 1, 5>(rows[0], rows[1]);
+			const VectorRegister t1 = __vector::permute<2, 6, 3, 7>(rows[0], rows[1]);
+			const VectorRegister t2 = __vector::permute<0, 4, 1, 5>(rows[2], rows[3]);
+			const VectorRegister t3 = __vector::permute<2, 6, 3, 7>(rows[2], rows[3]);
+			res.m[r * 4 + 0] = __vector::permute<0, 1, 4, 5>(t0, t2);
+			res.m[r * 4 + 1] = __vector::permute<2, 3, 6, 7>(t0, t2);
+			res.m[r * 4 + 2] = __vector::permute<0, 1, 4, 5>(t1, t3);
+			res.m[r * 4 + 3] = __vector::permute<2, 3, 6, 7>(t1, t3);
+		}
+		return res;
+	}
+
+	// Stores the first count lanes into a packed matrix array.
+	FORCEINLINE void store_float4x4(float4x4* first, const float4x4_lanes& v, const uint32 count)
+	{
+		for (uint32 r = 0; r < 4; ++r)
+		{
+			const VectorRegister* c = v.m + r * 4;
+			const VectorRegister t0 = __vector::permute<0, 4, 1, 5>(c[0], c[1]);
+			const VectorRegister t1 = __vector::permute<2, 6, 3, 7>(c[0], c[1]);
+			const VectorRegister t2 = __vector::permute<0, 4, 1, 5>(c[2], c[3]);
+			const VectorRegister t3 = __vector::permute<2, 6, 3, 7>(c[2], c[3]);
+			const VectorRegister rows[Width] = {
+				__vector::permute<0, 1, 4, 5>(t0, t2), __vector::permute<2, 3, 6, 7>(t0, t2),
+				__vector::permute<0, 1, 4, 5>(t1, t3), __vector::permute<2, 3, 6, 7>(t1, t3)
+			};
+			for (uint32 i = 0; i < count; ++i)
+				__vector::store_aligned(sakura::span<float, 4>(first[i].M[r], 4), rows[i]);
+		}
+	}
+
+	// General 4x4 inverse by cofactors, lane-wise. Singular lanes yield non-finite values.
+	FORCEINLINE float4x4_lanes inverse(const float4x4_lanes& a)
+	{
+		const VectorRegister* m = a.m;
+		// 2x2 determinants of the upper two rows (s) and the lower two rows (c).
+		const auto det2 = [](VectorRegister p, VectorRegister q, VectorRegister r, VectorRegister t)
+		{
+			return __vector::subtract(__vector::multiply(p, q), __vector::multiply(r, t));
+		};
+		const VectorRegister s0 = det2(m[0], m[5], m[4], m[1]);
+		const VectorRegister s1 = det2(m[0], m[6], m[4], m[2]);
+		const VectorRegister s2 = det2(m[0], m[7], m[4], m[3]);
+		const VectorRegister s3 = det2(m[1], m[6], m[5], m[2]);
+		const VectorRegister s4 = det2(m[1], m[7], m[5], m[3]);
+		const VectorRegister s5 = det2(m[2], m[7], m[6], m[3]);
+		const VectorRegister c5 = det2(m[10], m[15], m[14], m[11]);
+		const VectorRegister c4 = det2(m[9], m[15], m[13], m[11]);
+		const VectorRegister c3 = det2(m[9], m[14], m[13], m[10]);
+		const VectorRegister c2 = det2(m[8], m[15], m[12], m[11]);
+		const VectorRegister c1 = det2(m[8], m[14], m[12], m[10]);
+		const VectorRegister c0 = det2(m[8], m[13], m[12], m[9]);
+		const VectorRegister det = __vector::add(
+			__vector::add(__vector::subtract(__vector::multiply(s0, c5), __vector::multiply(s1, c4)), __vector::add(__vector::multiply(s2, c3), __vector::multiply(s3, c2))),
+			__vector::subtract(__vector::multiply(s5, c0), __vector::multiply(s4, c1)));
+		const VectorRegister invDet = __vector::reciprocal(det);
+		// x * p - y * q + z * r
+		const auto cofactor = [&](VectorRegister x, VectorRegister p, VectorRegister y, VectorRegister q, VectorRegister z, VectorRegister r)
+		{
+			return __vector::multiply(__vector::add(__vector::subtract(__vector::multiply(x, p), __vector::multiply(y, q)), __vector::multiply(z, r)), invDet);
+		};
+		float4x4_lanes res;
+		res.m[0] = cofactor(m[5], c5, m[6], c4, m[7], c3);
+		res.m[1] = __vector::negate(cofactor(m[1], c5, m[2], c4, m[3], c3));
+		res.m[2] = cofactor(m[13], s5, m[14], s4, m[15], s3);
+		res.m[3] = __vector::negate(cofactor(m[9], s5, m[10], s4, m[11], s3));
+		res.m[4] = __vector::negate(cofactor(m[4], c5, m[6], c2, m[7], c1));
+		res.m[5] = cofactor(m[0], c5, m[2], c2, m[3], c1);
+		res.m[6] = __vector::negate(cofactor(m[12], s5, m[14], s2, m[15], s1));
+		res.m[7] = cofactor(m[8], s5, m[10], s2, m[11], s1);
+		res.m[8] = cofactor(m[4], c4, m[5], c2, m[7], c0);
+		res.m[9] = __vector::negate(cofactor(m[0], c4, m[1], c2, m[3], c0));
+		res.m[10] = cofactor(m[12], s4, m[13], s2, m[15], s0);
+		res.m[11] = __vector::negate(cofactor(m[8], s4, m[9], s2, m[11], s0));
+		res.m[12] = __vector::negate(cofactor(m[4], c3, m[5], c1, m[6], c0));
+		res.m[13] = cofactor(m[0], c3, m[1], c1, m[2], c0);
+		res.m[14] = __vector::negate(cofactor(m[12], s3, m[13], s1, m[14], s0));
+		res.m[15] = cofactor(m[8], s3, m[9], s1, m[10], s0);
+		return res;
+	}
+}
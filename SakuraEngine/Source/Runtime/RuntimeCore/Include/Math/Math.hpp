@@ -9,6 +9,7 @@
 #include "Math/DXMath/SakuraDXMathVector.h"
 #include "Math/DXMath/SakuraDXMathQuaternion.h"
 #include "Math/DXMath/SakuraDXMathTransform.h"
+#include "Math/Lanes.h"
 #endif
 
 namespace sakura::math
@@ -0,0 +1,164 @@
+#pragma once
+#include "SakuraSTL.hpp"
+#include <array>
+#include <cstdint>
+#include <limits>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SAKURA_RANDOM_SSE2 1
+#endif
+
+// Counter-based random numbers: Philox4x32-10 (Salmon et al., "Parallel random
+// numbers: as easy as 1, 2, 3"). A block of four words is a pure function of a
+// 64 bit key (the seed) and a 128 bit counter, so tasks draw from their own
+// streams without any shared state and a simulation replays bit for bit whatever
+// the worker count. Counters are (stream, sample index / 4): streams are keyed by
+// whatever identifies the consumer, an entity id, a (frame, entity) or (frame, task) pair.
+namespace sakura::math
+{
+	namespace philox
+	{
+		constexpr uint32_t M0 = 0xD2511F53u, M1 = 0xCD9E8D57u;
+		constexpr uint32_t W0 = 0x9E3779B9u, W1 = 0xBB67AE85u;
+		constexpr uint32_t Rounds = 10;
+		using block = std::array<uint32_t, 4>;
+
+		FORCEINLINE block generate(const uint64_t key, const uint64_t stream, const uint64_t index) noexcept
+		{
+			uint32_t c0 = (uint32_t)index, c1 = (uint32_t)(index >> 32);
+			uint32_t c2 = (uint32_t)stream, c3 = (uint32_t)(stream >> 32);
+			uint32_t k0 = (uint32_t)key, k1 = (uint32_t)(key >> 32);
+			for (uint32_t r = 0; r < Rounds; ++r)
+			{
+				const uint64_t p0 = (uint64_t)M0 * c0;
+				const uint64_t p1 = (uint64_t)M1 * c2;
+				const uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+				const uint32_t n2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+				c0 = n0; c1 = (uint32_t)p1; c2 = n2; c3 = (uint32_t)p0;
+				k0 += W0; k1 += W1;
+			}
+			return { c0, c1, c2, c3 };
+		}
+
+		// [0, 1) from the top 24 bits, exact in a float.
+		FORCEINLINE float to_unit_float(const uint32_t bits) noexcept
+		{
+			return (float)(bits >> 8) * (1.f / 16777216.f);
+		}
+	}
+
+	// Sequential draws of one stream, four samples per Philox block. Satisfies
+	// UniformRandomBitGenerator, though uniform() is preferred for reproducibility:
+	// standard distributions differ between library implementations.
+	struct random_stream
+	{
+		using result_type = uint32_t;
+
+		random_stream(const uint64_t seed, const uint64_t stream, const uint64_t first = 0) noexcept
+			:key(seed), stream(stream), nextBlock(first / 4), position((uint32_t)(first % 4))
+		{
+			words = philox::generate(key, stream, nextBlock++);
+		}
+
+		static constexpr result_type min() { return 0; }
+		static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+		result_type operator()() noexcept
+		{
+			if (position == 4)
+			{
+				words = philox::generate(key, stream, nextBlock++);
+				position = 0;
+			}
+			return words[position++];
+		}
+
+		// Uniform in [0, 1).
+		float uniform() noexcept { return philox::to_unit_float((*this)()); }
+		// Uniform in [lowest, highest).
+		float uniform(const float lowest, const float highest) noexcept { return lowest + uniform() * (highest - lowest); }
+	private:
+		uint64_t key;
+		uint64_t stream;
+		uint64_t nextBlock;
+		uint32_t position;
+		philox::block words;
+	};
+
+#if SAKURA_RANDOM_SSE2
+	namespace philox
+	{
+		// Low and high halves of the 32x32 bit products of every lane with m.
+		FORCEINLINE void mulhilo(const __m128i a, const __m128i m, __m128i& lo, __m128i& hi) noexcept
+		{
+			const __m128i even = _mm_mul_epu32(a, m);
+			const __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), m);
+			const __m128i low = _mm_set_epi32(0, -1, 0, -1);
+			lo = _mm_or_si128(_mm_and_si128(even, low), _mm_slli_epi64(odd, 32));
+			hi = _mm_or_si128(_mm_srli_epi64(even, 32), _mm_andnot_si128(low, odd));
+		}
+
+		// Four consecutive blocks of a stream, one per lane, written as 16 samples in stream order.
+		FORCEINLINE void generate4(const uint64_t key, const uint64_t stream, const uint64_t index, uint32_t out[16]) noexcept
+		{
+			const uint64_t i1 = index + 1, i2 = index + 2, i3 = index + 3;
+			__m128i c0 = _mm_set_epi32((int)(uint32_t)i3, (int)(uint32_t)i2, (int)(uint32_t)i1, (int)(uint32_t)index);
+			__m128i c1 = _mm_set_epi32((int)(uint32_t)(i3 >> 32), (int)(uint32_t)(i2 >> 32), (int)(uint32_t)(i1 >> 32), (int)(uint32_t)(index >> 32));
+			__m128i c2 = _mm_set1_epi32((int)(uint32_t)stream);
+			__m128i c3 = _mm_set1_epi32((int)(uint32_t)(stream >> 32));
+			uint32_t k0 = (uint32_t)key, k1 = (uint32_t)(key >> 32);
+			const __m128i m0 = _mm_set1_epi32((int)M0), m1 = _mm_set1_epi32((int)M1);
+			for (uint32_t r = 0; r < Rounds; ++r)
+			{
+				__m128i lo0, hi0, lo1, hi1;
+				mulhilo(c0, m0, lo0, hi0);
+				mulhilo(c2, m1, lo1, hi1);
+				c0 = _mm_xor_si128(_mm_xor_si128(hi1, c1), _mm_set1_epi32((int)k0));
+				c1 = lo1;
+				c2 = _mm_xor_si128(_mm_xor_si128(hi0, c3), _mm_set1_epi32((int)k1));
+				c3 = lo0;
+				k0 += W0; k1 += W1;
+			}
+			// Lanes hold word j of four blocks, transposed so that each block is contiguous.
+			const __m128i t0 = _mm_unpacklo_epi32(c0, c1), t1 = _mm_unpacklo_epi32(c2, c3);
+			const __m128i t2 = _mm_unpackhi_epi32(c0, c1), t3 = _mm_unpackhi_epi32(c2, c3);
+			__m128i* dst = reinterpret_cast<__m128i*>(out);
+			_mm_storeu_si128(dst + 0, _mm_unpacklo_epi64(t0, t1));
+			_mm_storeu_si128(dst + 1, _mm_unpackhi_epi64(t0, t1));
+			_mm_storeu_si128(dst + 2, _mm_unpacklo_epi64(t2, t3));
+			_mm_storeu_si128(dst + 3, _mm_unpackhi_epi64(t2, t3));
+		}
+	}
+#endif
+
+	// Samples [first, first + count) of a stream as uniform floats in [0, 1), the
+	// same values random_stream(seed, stream, first) draws. Whole groups of four
+	// blocks run in SSE2 lanes, 16 samples per pass.
+	FORCEINLINE void fill_uniform(const uint64_t seed, const uint64_t stream, const uint64_t first, float* out, const uint32_t count) noexcept
+	{
+		uint32_t i = 0;
+		// Leading samples up to a block boundary, then whole blocks.
+		random_stream head(seed, stream, first);
+		for (; i < count && (first + i) % 4 != 0; ++i)
+			out[i] = head.uniform();
+#if SAKURA_RANDOM_SSE2
+		for (; i + 16 <= count; i += 16)
+		{
+			alignas(16) uint32_t words[16];
+			philox::generate4(seed, stream, (first + i) / 4, words);
+			const __m128 scale = _mm_set1_ps(1.f / 16777216.f);
+			for (uint32_t j = 0; j < 16; j += 4)
+			{
+				const __m128i bits = _mm_srli_epi32(_mm_load_si128(reinterpret_cast<const __m128i*>(words + j)), 8);
+				_mm_storeu_ps(out + i + j, _mm_mul_ps(_mm_cvtepi32_ps(bits), scale));
+			}
+		}
+#endif
+		if (i < count)
+		{
+			random_stream tail(seed, stream, first + i);
+			for (; i < count; ++i)
+				out[i] = tail.uniform();
+		}
+	}
+}
@@ -2,6 +2,7 @@
 #include <System/vfs/entry.h>
 #include <System/vfs/adapter.h>
 #include <System/vfs/file.h>
+#include <System/vfs/mapped_file.h>
 #include <System/vfs/path.h>
 #include <System/vfs/dir.h>
 
@@ -10,4 +11,6 @@ namespace sakura::vfs
 	[[nodiscard]] RuntimeCoreAPI sakura::vfs::entry* try_entry(const path& pth);
 	[[nodiscard]] RuntimeCoreAPI sakura::vfs::file* try_open_file(const path& pth, const char* mode, bool create_missed_dirs = false);
 	[[nodiscard]] RuntimeCoreAPI sakura::vfs::dir* try_open_dir(const path& pth);
+	// read-only mapping of an existing file, nullptr if the entry is missing.
+	[[nodiscard]] RuntimeCoreAPI sakura::vfs::mapped_file* try_map_file(const path& pth);
 }
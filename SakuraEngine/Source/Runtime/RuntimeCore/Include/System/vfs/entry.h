@@ -4,6 +4,7 @@
 namespace sakura::vfs
 {
 	struct file;
+	struct mapped_file;
 	struct dir;
 	struct path;
 }
@@ -16,6 +17,7 @@ namespace sakura::vfs
 		
 		[[nodiscard]] virtual sakura::vfs::file* open_as_file(const char* mode) noexcept = 0;
 		[[nodiscard]] virtual sakura::vfs::dir* open_as_dir() noexcept = 0;
+		[[nodiscard]] virtual sakura::vfs::mapped_file* map_as_file() noexcept = 0;
 		
 		[[nodiscard]] virtual bool exists() const noexcept = 0;
 
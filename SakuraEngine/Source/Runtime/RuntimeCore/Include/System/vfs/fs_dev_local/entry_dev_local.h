@@ -12,6 +12,7 @@ namespace sakura::vfs::dev_local
 		
 		[[nodiscard]] virtual sakura::vfs::file* open_as_file(const char* mode) noexcept override;
 		[[nodiscard]] virtual sakura::vfs::dir* open_as_dir() noexcept override;
+		[[nodiscard]] virtual sakura::vfs::mapped_file* map_as_file() noexcept override;
 		
 		virtual bool exists() const noexcept override;
 		
@@ -0,0 +1,26 @@
+﻿#pragma once
+#include "../mapped_file.h"
+#include <SakuraSTL.hpp>
+#include <filesystem>
+
+namespace sakura::vfs::dev_local
+{
+	// constructor & destructor are platform specific.
+	class RuntimeCoreAPI mapped_file_dev_local final : public sakura::vfs::mapped_file
+	{
+	public:
+		mapped_file_dev_local(const std::filesystem::path&);
+		~mapped_file_dev_local() override;
+
+		virtual bool valid() const final;
+		[[nodiscard]] virtual const void* data() const final;
+		virtual size_t size() const final;
+
+	protected:
+		const void* loc_data = nullptr;
+		size_t loc_size = 0;
+		// platform handles of the mapping.
+		void* loc_file = nullptr;
+		void* loc_mapping = nullptr;
+	};
+}
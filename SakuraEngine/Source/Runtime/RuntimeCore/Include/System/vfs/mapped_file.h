@@ -0,0 +1,19 @@
+﻿#pragma once
+#include <cstddef>
+
+namespace sakura::vfs
+{
+	// read-only memory mapping of a whole file.
+	// mapped on construction & unmapped on destruction with RAII.
+	struct RuntimeCoreAPI mapped_file
+	{
+		virtual ~mapped_file() noexcept {}
+
+		virtual bool valid() const = 0;
+
+		// first byte of the mapping, nullptr when invalid.
+		[[nodiscard]] virtual const void* data() const = 0;
+
+		virtual size_t size() const = 0;
+	};
+}
@@ -0,0 +1,234 @@
+#pragma once
+#include "TaskSystem/TaskSystem.h"
+#include <array>
+#include <limits>
+
+namespace sakura::task_system
+{
+    // Statistics recorded from any task without contention: every worker updates a
+    // slot on its own cache line, slots are only combined when read. Reads are meant
+    // for sync points (typically frame end, after the recording tasks are done);
+    // reading while tasks record is safe but may miss their latest samples.
+    //
+    // publish() hands the merged values to the profiler through one sink, so every
+    // counter shows up the same way. RuntimeCore does not depend on the profiler, its
+    // integration installs the sink (Tracker: plot_counters_to_tracy). Plot names are
+    // kept by pointer and must be string literals.
+    using counter_plot_t = void(*)(const char* name, double value);
+    // nullptr, the default, drops published values.
+    RuntimeCoreAPI void set_counter_plot(counter_plot_t plot) noexcept;
+    RuntimeCoreAPI void plot_counter(const char* name, double value) noexcept;
+
+    namespace detail
+    {
+        constexpr size_t CounterCacheLine = 64;
+        constexpr uint32_t CounterSlots = 128;
+
+        // The first CounterSlots workers own a slot each and update it with plain
+        // relaxed loads and stores, any later thread goes to the last, shared slot
+        // with read-modify-writes.
+        inline uint32_t counter_slot() noexcept
+        {
+            const uint32_t index = worker_index();
+            return index < CounterSlots ? index : CounterSlots;
+        }
+
+        inline bool shared_counter_slot(uint32_t slot) noexcept
+        {
+            return slot == CounterSlots;
+        }
+
+        template<class T, class F>
+        void owned_update(std::atomic<T>& target, F&& next) noexcept
+        {
+            target.store(next(target.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+        }
+
+        template<class T, class F>
+        void atomic_update(std::atomic<T>& target, F&& next) noexcept
+        {
+            T value = target.load(std::memory_order_relaxed);
+            while (!target.compare_exchange_weak(value, next(value), std::memory_order_relaxed)) {}
+        }
+    }
+
+    // Sum, minimum, maximum and sample count of a value.
+    template<class T>
+    struct sharded_stat
+    {
+        static_assert(std::is_arithmetic_v<T>, "sharded_stat: T must be arithmetic");
+        struct summary
+        {
+            T sum = T(0);
+            T min = std::numeric_limits<T>::max();
+            T max = std::numeric_limits<T>::lowest();
+            uint64_t count = 0;
+
+            double average() const { return count == 0 ? 0.0 : double(sum) / double(count); }
+        };
+
+        sharded_stat() noexcept { reset(); }
+        sharded_stat(const sharded_stat&) = delete;
+        sharded_stat& operator=(const sharded_stat&) = delete;
+
+        void record(T value) noexcept
+        {
+            const uint32_t index = detail::counter_slot();
+            if (detail::shared_counter_slot(index))
+                update(slots[index], value, [](auto& target, auto&& next) { detail::atomic_update(target, next); });
+            else
+                update(slots[index], value, [](auto& target, auto&& next) { detail::owned_update(target, next); });
+        }
+
+        summary read() const noexcept
+        {
+            summary result;
+            for (const auto& s : slots)
+            {
+                const uint64_t count = s.count.load(std::memory_order_relaxed);
+                if (count == 0)
+                    continue;
+                result.sum += s.sum.load(std::memory_order_relaxed);
+                result.min = std::min(result.min, s.min.load(std::memory_order_relaxed));
+                result.max = std::max(result.max, s.max.load(std::memory_order_relaxed));
+                result.count += count;
+            }
+            return result;
+        }
+
+        void reset() noexcept
+        {
+            const summary empty;
+            for (auto& s : slots)
+            {
+                s.sum.store(empty.sum, std::memory_order_relaxed);
+                s.min.store(empty.min, std::memory_order_relaxed);
+                s.max.store(empty.max, std::memory_order_relaxed);
+                s.count.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        // Read, then start over, for per-frame statistics.
+        summary collect() noexcept
+        {
+            const summary result = read();
+            reset();
+            return result;
+        }
+
+        // Collects, plots the average under name and, if given, the maximum under maxName.
+        summary publish(const char* name, const char* maxName = nullptr) noexcept
+        {
+            const summary result = collect();
+            plot_counter(name, result.average());
+            if (maxName)
+                plot_counter(maxName, result.count == 0 ? 0.0 : double(result.max));
+            return result;
+        }
+    private:
+        struct alignas(detail::CounterCacheLine) slot
+        {
+            std::atomic<T> sum;
+            std::atomic<T> min;
+            std::atomic<T> max;
+            std::atomic<uint64_t> count;
+        };
+
+        template<class U>
+        static void update(slot& s, T value, U&& apply) noexcept
+        {
+            apply(s.sum, [value](T sum) { return T(sum + value); });
+            apply(s.min, [value](T min) { return value < min ? value : min; });
+            apply(s.max, [value](T max) { return max < value ? value : max; });
+            apply(s.count, [](uint64_t count) { return count + 1; });
+        }
+        std::array<slot, detail::CounterSlots + 1> slots;
+    };
+
+    // Sample counts over Buckets equal-width buckets of [lowest, highest), values
+    // outside the range land in the first or last bucket.
+    template<uint32_t Buckets>
+    struct sharded_histogram
+    {
+        static_assert(Buckets > 0, "sharded_histogram: at least one bucket");
+        using counts = std::array<uint64_t, Buckets>;
+
+        sharded_histogram(double lowest, double highest) noexcept
+            :lowest(lowest), scale(Buckets / (highest - lowest))
+        {
+            reset();
+        }
+        sharded_histogram(const sharded_histogram&) = delete;
+        sharded_histogram& operator=(const sharded_histogram&) = delete;
+
+        void record(double value) noexcept
+        {
+            const double position = (value - lowest) * scale;
+            const uint32_t bucket = position <= 0.0 ? 0 : position >= Buckets ? Buckets - 1 : (uint32_t)position;
+            const uint32_t index = detail::counter_slot();
+            auto& count = slots[index].buckets[bucket];
+            if (detail::shared_counter_slot(index))
+                count.fetch_add(1, std::memory_order_relaxed);
+            else
+                count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+
+        counts read() const noexcept
+        {
+            counts result{};
+            for (const auto& s : slots)
+                for (uint32_t b = 0; b < Buckets; ++b)
+                    result[b] += s.buckets[b].load(std::memory_order_relaxed);
+            return result;
+        }
+
+        void reset() noexcept
+        {
+            for (auto& s : slots)
+                for (auto& b : s.buckets)
+                    b.store(0, std::memory_order_relaxed);
+        }
+
+        counts collect() noexcept
+        {
+            const counts result = read();
+            reset();
+            return result;
+        }
+
+        // Collects and plots the q-th quantile under name.
+        counts publish(const char* name, double q) noexcept
+        {
+            const counts result = collect();
+            plot_counter(name, quantile(result, q));
+            return result;
+        }
+
+        // Upper edge of the bucket holding the q-th quantile (0 <= q <= 1) of values.
+        double quantile(const counts& values, double q) const noexcept
+        {
+            uint64_t total = 0;
+            for (auto c : values)
+                total += c;
+            const double target = q * (double)total;
+            uint64_t seen = 0;
+            for (uint32_t b = 0; b < Buckets; ++b)
+            {
+                seen += values[b];
+                if (seen > 0 && (double)seen >= target)
+                    return lowest + (b + 1) / scale;
+            }
+            return lowest + Buckets / scale;
+        }
+
+        double bucket_lower_edge(uint32_t bucket) const noexcept { return lowest + bucket / scale; }
+    private:
+        struct alignas(detail::CounterCacheLine) slot
+        {
+            std::array<std::atomic<uint64_t>, Buckets> buckets;
+        };
+        const double lowest;
+        const double scale;
+        std::array<slot, detail::CounterSlots + 1> slots;
+    };
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include "SakuraSTL.hpp"
+#include "TaskSystem/TaskSystem.h"
+#include <array>
+#include <memory>
+#include <mutex>
+
+namespace sakura::task_system
+{
+    // One T per worker, created on first use by the worker itself, so tasks reach
+    // their own instance without locking. Threads indexed past MaxWorkers get their
+    // own instance too, looked up under a lock. Instances live as long as the
+    // container; iterating must not run concurrently with workers using them.
+    template<class T>
+    struct per_worker
+    {
+        static constexpr uint32_t MaxWorkers = 128;
+
+        per_worker() noexcept
+        {
+            for (auto& slot : slots)
+                slot.store(nullptr, std::memory_order_relaxed);
+        }
+        ~per_worker()
+        {
+            for (auto& slot : slots)
+                delete slot.load(std::memory_order_relaxed);
+        }
+        per_worker(const per_worker&) = delete;
+        per_worker& operator=(const per_worker&) = delete;
+
+        // Instance of the calling worker, constructed from args on first use.
+        template<class... Args>
+        T& local(Args&&... args)
+        {
+            const uint32_t index = worker_index();
+            if (index >= MaxWorkers)
+            {
+                std::lock_guard<std::mutex> guard(overflowLock);
+                auto& instance = overflow[index];
+                if (!instance)
+                    instance = std::make_unique<T>(std::forward<Args>(args)...);
+                return *instance;
+            }
+            // Only this thread ever creates its slot.
+            T* instance = slots[index].load(std::memory_order_acquire);
+            if (!instance)
+            {
+                instance = new T(std::forward<Args>(args)...);
+                slots[index].store(instance, std::memory_order_release);
+            }
+            return *instance;
+        }
+
+        // Runs f(workerIndex, instance) for every instance created so far.
+        template<class F>
+        void for_each(F&& f)
+        {
+            for (uint32_t i = 0; i < MaxWorkers; ++i)
+                if (T* instance = slots[i].load(std::memory_order_acquire))
+                    f(i, *instance);
+            std::lock_guard<std::mutex> guard(overflowLock);
+            for (auto& pair : overflow)
+                f(pair.first, *pair.second);
+        }
+        template<class F>
+        void for_each(F&& f) const
+        {
+            for (uint32_t i = 0; i < MaxWorkers; ++i)
+                if (const T* instance = slots[i].load(std::memory_order_acquire))
+                    f(i, *instance);
+            std::lock_guard<std::mutex> guard(overflowLock);
+            for (auto& pair : overflow)
+                f(pair.first, static_cast<const T&>(*pair.second));
+        }
+    private:
+        std::array<std::atomic<T*>, MaxWorkers> slots;
+        mutable std::mutex overflowLock;
+        sakura::unordered_map<uint32_t, std::unique_ptr<T>> overflow;
+    };
+}
@@ -3,10 +3,127 @@
 #include "marl/event.h"
 #include "marl/scheduler.h"
 #include "marl/waitgroup.h"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <new>
+#include <stdint.h>
+#include <type_traits>
+#include <gsl/span>
 
 namespace sakura::task_system
 {
     using namespace marl;
 
     using marl::schedule;
+
+    // Dense index of the calling thread, assigned on first use and stable for the
+    // thread's lifetime. marl fibers never migrate between workers, so it can key
+    // per-worker storage from inside a task.
+    RuntimeCoreAPI uint32_t worker_index() noexcept;
+
+    // Up to N events stored inline, for building dependency lists without touching
+    // the heap. Converts to a span for the functions taking dependencies.
+    template<size_t N>
+    struct event_list
+    {
+        event_list() = default;
+        event_list(event_list&& other) noexcept
+        {
+            for (auto& e : other)
+                push_back(std::move(e));
+        }
+        event_list(const event_list&) = delete;
+        event_list& operator=(const event_list&) = delete;
+        ~event_list()
+        {
+            for (auto& e : *this)
+                e.~Event();
+        }
+        void push_back(Event e)
+        {
+            assert(count < N && "event_list is full");
+            new (&storage[count++]) Event(std::move(e));
+        }
+        size_t size() const { return count; }
+        Event* begin() { return std::launder(reinterpret_cast<Event*>(storage)); }
+        Event* end() { return begin() + count; }
+        const Event* begin() const { return std::launder(reinterpret_cast<const Event*>(storage)); }
+        const Event* end() const { return begin() + count; }
+        operator gsl::span<const Event>() const { return { begin(), count }; }
+    private:
+        std::aligned_storage_t<sizeof(Event), alignof(Event)> storage[N];
+        size_t count = 0;
+    };
+
+    namespace detail
+    {
+        // Join state of one parallel_for call. Records are pooled per thread and
+        // never freed, fibers do not migrate, so a record goes back to the pool it
+        // came from.
+        struct parallel_join
+        {
+            std::atomic<uint32_t> pending = 0;
+            Event done = Event(Event::Mode::Manual);
+        };
+        RuntimeCoreAPI parallel_join* acquire_join();
+        RuntimeCoreAPI void release_join(parallel_join* join) noexcept;
+    }
+
+    // Runs fn(i) for every i in [0, count). The range is published once: at most one
+    // helper task per worker is scheduled and every participant, the caller included,
+    // claims [grain] indices at a time from a shared atomic cursor until it runs dry.
+    // Returns after all indices ran. submitNs, if set, receives the time spent
+    // scheduling the helpers. Helpers capture two pointers and the join record is
+    // pooled, so once warm a call does not allocate.
+    template<class F>
+    void parallel_for(uint32_t count, uint32_t grain, F&& fn, uint64_t* submitNs = nullptr)
+    {
+        if (submitNs)
+            *submitNs = 0;
+        if (count == 0)
+            return;
+        grain = std::max(grain, 1u);
+        const uint32_t chunks = (count + grain - 1) / grain;
+        const auto scheduler = Scheduler::get();
+        const uint32_t workers = scheduler ? (uint32_t)std::max(scheduler->config().workerThread.count, 0) : 0;
+        const uint32_t helpers = std::min(workers, chunks - 1);
+        struct shared_range
+        {
+            F& fn;
+            const uint32_t count;
+            const uint32_t grain;
+            std::atomic<uint32_t> cursor = 0;
+            void drain()
+            {
+                for (uint32_t begin = cursor.fetch_add(grain, std::memory_order_relaxed); begin < count;
+                    begin = cursor.fetch_add(grain, std::memory_order_relaxed))
+                {
+                    const uint32_t end = std::min(begin + grain, count);
+                    for (uint32_t i = begin; i < end; ++i)
+                        fn(i);
+                }
+            }
+        } range{ fn, count, grain };
+        if (helpers == 0)
+            return range.drain();
+        const auto start = std::chrono::steady_clock::now();
+        detail::parallel_join* join = detail::acquire_join();
+        join->pending.store(helpers, std::memory_order_relaxed);
+        for (uint32_t i = 0; i < helpers; ++i)
+            schedule([shared = &range, join] {
+                shared->drain();
+                // range lives on the caller's stack and is gone once the last helper signals.
+                if (join->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                    join->done.signal();
+            });
+        if (submitNs)
+            *submitNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        range.drain();
+        join->done.wait();
+        join->done.clear();
+        detail::release_join(join);
+    }
 }
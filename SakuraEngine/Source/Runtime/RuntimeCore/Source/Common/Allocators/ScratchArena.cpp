@@ -0,0 +1,90 @@
+﻿/*
+ * @Description: Growable bump allocator for per-frame scratch memory.
+ * @FilePath: \allocators\ScratchArena.cpp
+ */
+#include <cassert>   /*assert		*/
+#include <algorithm>    // max
+#include <cstdlib>
+#define API_EXPORTS 1
+#include "Allocators/Utils.h"  /* CalculatePadding */
+#include "Allocators/ScratchArena.h"
+
+using namespace sakura;
+
+namespace
+{
+    // Block headers keep the payload aligned for any fundamental type.
+    constexpr std::size_t HeaderSize = (sizeof(void*) * 2 + alignof(std::max_align_t) - 1)
+        / alignof(std::max_align_t) * alignof(std::max_align_t);
+}
+
+RuntimeCoreAPI scratch_arena::scratch_arena(const std::size_t blockSize)
+: allocator(0), m_blockSize(std::max(blockSize, HeaderSize * 2))
+{
+    m_peak = 0;
+}
+
+RuntimeCoreAPI scratch_arena::~scratch_arena() {
+    release();
+}
+
+RuntimeCoreAPI void scratch_arena::init() {
+}
+
+RuntimeCoreAPI void* scratch_arena::allocate(const std::size_t size, const std::size_t alignment) {
+    const std::size_t align = alignment == 0 ? alignof(std::max_align_t) : alignment;
+    std::size_t padding = 0;
+    if (m_head != nullptr) {
+        const std::size_t currentAddress = (std::size_t)m_head + m_offset;
+        if (currentAddress % align != 0)
+            padding = Utils::CalculatePadding(currentAddress, align);
+    }
+    if (m_head == nullptr || m_offset + padding + size > m_head->size) {
+        grow(HeaderSize + size + align);
+        const std::size_t currentAddress = (std::size_t)m_head + m_offset;
+        padding = currentAddress % align != 0 ? Utils::CalculatePadding(currentAddress, align) : 0;
+    }
+    void* result = (void*)((std::size_t)m_head + m_offset + padding);
+    m_offset += padding + size;
+    m_used += padding + size;
+    m_peak = std::max(m_peak, m_used);
+    return result;
+}
+
+RuntimeCoreAPI void scratch_arena::free(void* ptr) {
+}
+
+RuntimeCoreAPI void scratch_arena::reset() {
+    if (m_blockCount > 1) {
+        // Replace the chain by one block that fits the whole frame.
+        const std::size_t merged = m_totalSize;
+        release();
+        grow(merged);
+    }
+    m_offset = HeaderSize;
+    m_used = 0;
+}
+
+void scratch_arena::grow(const std::size_t minSize) {
+    const std::size_t size = std::max(m_blockSize, minSize);
+    block* fresh = static_cast<block*>(std::malloc(size));
+    assert(fresh != nullptr && "scratch_arena: out of memory");
+    fresh->next = m_head;
+    fresh->size = size;
+    m_head = fresh;
+    m_offset = HeaderSize;
+    m_totalSize += size;
+    m_blockCount++;
+    m_heapAllocations++;
+}
+
+void scratch_arena::release() {
+    while (m_head != nullptr) {
+        block* next = m_head->next;
+        std::free(m_head);
+        m_head = next;
+    }
+    m_totalSize = 0;
+    m_blockCount = 0;
+    m_offset = 0;
+}
@@ -33,3 +33,10 @@ sakura::vfs::dir* sakura::vfs::try_open_dir(const path& pth)
 		return entry->open_as_dir();
 	return nullptr;
 }
+
+sakura::vfs::mapped_file* sakura::vfs::try_map_file(const path& pth)
+{
+	if (auto entry = sakura::unique_ptr<sakura::vfs::entry>(try_entry(pth)); entry)
+		return entry->map_as_file();
+	return nullptr;
+}
@@ -29,6 +29,7 @@
 #include <System/vfs/fs_dev_local/adapter_dev_local.h>
 #include <System/vfs/fs_dev_local/file_dev_local.h>
 #include <System/vfs/fs_dev_local/dir_dev_local.h>
+#include <System/vfs/fs_dev_local/mapped_file_dev_local.h>
 
 using namespace sakura::vfs::dev_local;
 
@@ -92,6 +93,11 @@ sakura::vfs::dir* entry_dev_local::open_as_dir() noexcept
 	return new sakura::vfs::dev_local::dir_dev_local(std_entry.path());
 }
 
+sakura::vfs::mapped_file* entry_dev_local::map_as_file() noexcept
+{
+	return new sakura::vfs::dev_local::mapped_file_dev_local(std_entry.path());
+}
+
 bool entry_dev_local::exists() const noexcept
 {
 	return std_entry.exists();
@@ -143,7 +149,8 @@ file_dev_local::file_dev_local(
 
 file_dev_local::~file_dev_local()
 {
-	fclose(loc_file);
+	if (loc_file)
+		fclose(loc_file);
 }
 
 bool file_dev_local::valid() const
@@ -186,6 +193,22 @@ size_t file_dev_local::tell() const
 	return ::ftell(loc_file);
 }
 
+// mapped file implementations, mapping itself lives in Platform/.
+bool mapped_file_dev_local::valid() const
+{
+	return loc_data != nullptr;
+}
+
+const void* mapped_file_dev_local::data() const
+{
+	return loc_data;
+}
+
+size_t mapped_file_dev_local::size() const
+{
+	return loc_size;
+}
+
 // directory implementation.
 dir_dev_local::dir_dev_local(const std::filesystem::path& stdPath)
 	:std_dir_(stdPath)
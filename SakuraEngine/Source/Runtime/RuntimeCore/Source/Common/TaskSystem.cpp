@@ -0,0 +1,63 @@
+#include "TaskSystem/TaskSystem.h"
+#include "TaskSystem/Counters.h"
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace sakura::task_system
+{
+	uint32_t worker_index() noexcept
+	{
+		static std::atomic<uint32_t> workerCount = 0;
+		thread_local const uint32_t index = workerCount.fetch_add(1, std::memory_order_relaxed);
+		return index;
+	}
+
+	namespace
+	{
+		std::atomic<counter_plot_t> counterPlot = nullptr;
+	}
+
+	void set_counter_plot(counter_plot_t plot) noexcept
+	{
+		counterPlot.store(plot, std::memory_order_release);
+	}
+
+	void plot_counter(const char* name, double value) noexcept
+	{
+		if (const auto plot = counterPlot.load(std::memory_order_acquire))
+			plot(name, value);
+	}
+
+	namespace detail
+	{
+		namespace
+		{
+			struct join_pool
+			{
+				std::vector<std::unique_ptr<parallel_join>> owned;
+				std::vector<parallel_join*> free;
+			};
+			thread_local join_pool joins;
+		}
+
+		parallel_join* acquire_join()
+		{
+			if (joins.free.empty())
+			{
+				joins.owned.push_back(std::make_unique<parallel_join>());
+				// Room for every record of the thread, releasing one never reallocates.
+				joins.free.reserve(joins.owned.size());
+				return joins.owned.back().get();
+			}
+			parallel_join* join = joins.free.back();
+			joins.free.pop_back();
+			return join;
+		}
+
+		void release_join(parallel_join* join) noexcept
+		{
+			joins.free.push_back(join);
+		}
+	}
+}
@@ -0,0 +1,33 @@
+﻿#include <System/vfs/fs_dev_local/mapped_file_dev_local.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace sakura::vfs::dev_local;
+
+mapped_file_dev_local::mapped_file_dev_local(const std::filesystem::path& pth)
+{
+	const int fd = ::open(pth.string().c_str(), O_RDONLY);
+	if (fd < 0)
+		return;
+	struct stat st;
+	// empty files can not be mapped.
+	if (::fstat(fd, &st) == 0 && st.st_size > 0)
+	{
+		void* mapped = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapped != MAP_FAILED)
+		{
+			loc_data = mapped;
+			loc_size = static_cast<size_t>(st.st_size);
+		}
+	}
+	// the mapping keeps its own reference to the file.
+	::close(fd);
+}
+
+mapped_file_dev_local::~mapped_file_dev_local()
+{
+	if (loc_data)
+		::munmap(const_cast<void*>(loc_data), loc_size);
+}
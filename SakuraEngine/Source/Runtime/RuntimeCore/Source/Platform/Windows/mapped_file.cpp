@@ -0,0 +1,33 @@
+﻿#include <System/vfs/fs_dev_local/mapped_file_dev_local.h>
+#include <windows.h>
+
+using namespace sakura::vfs::dev_local;
+
+mapped_file_dev_local::mapped_file_dev_local(const std::filesystem::path& pth)
+{
+	HANDLE file = ::CreateFileW(pth.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ,
+		nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return;
+	loc_file = file;
+	LARGE_INTEGER size;
+	// empty files can not be mapped.
+	if (!::GetFileSizeEx(file, &size) || size.QuadPart == 0)
+		return;
+	loc_mapping = ::CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!loc_mapping)
+		return;
+	loc_data = ::MapViewOfFile(loc_mapping, FILE_MAP_READ, 0, 0, 0);
+	if (loc_data)
+		loc_size = static_cast<size_t>(size.QuadPart);
+}
+
+mapped_file_dev_local::~mapped_file_dev_local()
+{
+	if (loc_data)
+		::UnmapViewOfFile(loc_data);
+	if (loc_mapping)
+		::CloseHandle(loc_mapping);
+	if (loc_file)
+		::CloseHandle(loc_file);
+}
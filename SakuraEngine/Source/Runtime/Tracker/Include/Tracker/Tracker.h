@@ -1,3 +1,5 @@
 #pragma once
 
-TrackerAPI void do_nothing();
\ No newline at end of file
+TrackerAPI void do_nothing();
+// Routes the sharded counters' publish() to Tracy plots.
+TrackerAPI void plot_counters_to_tracy();
\ No newline at end of file
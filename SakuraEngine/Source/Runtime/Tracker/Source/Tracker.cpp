@@ -1,6 +1,16 @@
 #include "Tracker/Tracker.h"
+#include "TaskSystem/Counters.h"
+#include "tracy/Tracy.hpp"
 
 void do_nothing()
 {
 
+}
+
+void plot_counters_to_tracy()
+{
+	sakura::task_system::set_counter_plot([](const char* name, double value)
+	{
+		TracyPlot(name, value);
+	});
 }
\ No newline at end of file
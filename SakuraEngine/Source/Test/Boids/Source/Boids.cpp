@@ -12,15 +12,20 @@
 #include "System/Log.h"
 
 #include "ECS/ECS.h"
+#include "ECS/Spawn.h"
+#include "ECS/EntityLookup.h"
+#include "ECS/RandomWrites.h"
 
 #include "TransformComponents.h"
 #include "RenderSystem.h"
 #include "Boids.h"
 #include "TaskSystem/TaskSystem.h"
+#include "TaskSystem/Counters.h"
+#include "TaskSystem/PerWorker.h"
+#include "Tracker/Tracker.h"
 #include "RuntimeCore/RuntimeCore.h"
 #include "kdtree.h"
 #include <iostream>
-#include <random>
 #include <cmath>
 
 
@@ -66,18 +71,14 @@ task_system::Event ConvertSystem(task_system::ecs::pipeline& ppl, ecs::filters&
 {
 	using namespace ecs;
 	static_assert(std::is_invocable<F, value_type_t<T>, const value_type_t<Ts>...>(), "wrong signature of convert function");
-	static size_t timestamp = 0;
-	filter.chunkFilter =
-	{
-		complist<Ts...>,
-		timestamp
-	};
 	def paramList = hana::tuple{
 		param<T>,
 		param<const Ts>...
 	};
-	timestamp = ppl.get_timestamp();
-	return task_system::ecs::schedule(ppl, *ppl.create_pass(filter, paramList),
+	// Only chunks whose Ts changed since this system last ran.
+	auto convertPass = ppl.create_pass(filter, paramList);
+	ppl.watch_changes(*convertPass);
+	return task_system::ecs::schedule(ppl, *convertPass,
 		[f](const task_system::ecs::pipeline& pipeline, const pass& pass, const task& tk)
 		{
 			ZoneScopedN("ConvertSystem");
@@ -134,6 +135,56 @@ task_system::Event HeadingSystem(task_system::ecs::pipeline& ppl)
 		});
 }
 
+// Children's transforms are written to other entities, the writes are deferred
+// so that roots can be solved in parallel. A generation of children is only known
+// once the previous one's Child buffers are read, so each generation is looked up
+// in its own batch and read chunk by chunk.
+struct children2World
+{
+	sakura::vector<ecs::entity> children, nextChildren;
+	sakura::vector<float4x4> parentToWorlds, nextParentToWorlds;
+	task_system::ecs::entity_lookup lookup;
+
+	template<class Children>
+	void solve(task_system::ecs::random_writes& writes, const ecs::task& tk, const float4x4& root_l2w, const Children& rootChildren)
+	{
+		children.assign(rootChildren.begin(), rootChildren.end());
+		parentToWorlds.assign(children.size(), root_l2w);
+		while (!children.empty())
+		{
+			lookup.resolve(ctx, { children.data(), children.size() });
+			nextChildren.clear();
+			nextParentToWorlds.clear();
+			for (const auto& g : lookup.groups())
+			{
+				const auto l2ps = static_cast<const float4x4*>(ctx.get_owned_ro(g.c, ecs::cid<LocalToParent>));
+				// Child is a buffer, it is read entity by entity in the chunks owning it.
+				const bool hasChildren = ctx.get_owned_ro(g.c, ecs::cid<Child>) != nullptr;
+				for (const auto& l : lookup.locations(g))
+				{
+					const ecs::entity e = children[l.order];
+					float4x4 l2w = float4x4();
+					if (l2ps)
+					{
+						l2w = sakura::math::multiply(parentToWorlds[l.order], l2ps[l.index]);
+						writes.write<LocalToWorld>(tk, e, l2w);
+					}
+					if (!hasChildren)
+						continue;
+					ecs::value_type_t<Child> child_children = ctx.get_owned_ro(e, ecs::cid<Child>);
+					for (auto& child : child_children)
+					{
+						nextChildren.push_back(child);
+						nextParentToWorlds.push_back(l2w);
+					}
+				}
+			}
+			std::swap(children, nextChildren);
+			std::swap(parentToWorlds, nextParentToWorlds);
+		}
+	}
+};
+
 task_system::Event Child2WorldSystem(task_system::ecs::pipeline& ppl)
 {
 	using namespace ecs;
@@ -149,46 +200,24 @@ task_system::Event Child2WorldSystem(task_system::ecs::pipeline& ppl)
 		// read.
 		param<const LocalToParent>, param<const Child>
 	);
-	struct children2World
-	{
-		static void solve(const float4x4& parent_l2w, const entity e)
-		{
-			float4x4 l2w = float4x4();
-			auto child_l2w = static_cast<float4x4*>(ctx.get_owned_rw(e, cid<LocalToWorld>));
-			const auto child_l2p = static_cast<const float4x4*>(ctx.get_owned_ro(e, cid<LocalToParent>));
-			if (child_l2w && child_l2p)
-			{
-				l2w = sakura::math::multiply(parent_l2w, *child_l2p);
-				*child_l2w = l2w;
-			}
-
-			index_t childSet[] = { cid<Child> };
-			if (ctx.has_component(e, childSet))
-			{
-				ecs::value_type_t<Child> child_children = ctx.get_owned_ro(e, cid<Child>);
-				for (auto& child : child_children)
-				{
-					children2World::solve(l2w, child);
-				}
-			}
-		}
-	};
-	return task_system::ecs::schedule(ppl,
-		*ppl.create_pass(filter, paramList),
-		[](const task_system::ecs::pipeline& pipeline, const ecs::pass& pass, const ecs::task& tk)
+	auto pass = ppl.create_pass(filter, paramList);
+	auto writes = ppl.persistent_resource<task_system::ecs::random_writes>("Boids.Child2WorldWrites", ctx);
+	// Scratch of each worker, kept with the pipeline's resources.
+	auto solvers = ppl.persistent_resource<task_system::per_worker<children2World>>("Boids.Child2WorldSolvers");
+	ppl.defer_random_writes(*pass, *writes);
+	return task_system::ecs::schedule(ppl, *pass,
+		[writes, solvers](const task_system::ecs::pipeline& pipeline, const ecs::pass& pass, const ecs::task& tk)
 		{
 			ZoneScopedN("Child2WorldSystem");
 			auto o = operation{ paramList, pass, tk };
 			const auto childrens = o.get_parameter<const Child>();
 			float4x4* l2ws = o.get_parameter<LocalToWorld>();
 
+			auto& solver = solvers->local();
 			forloop(i, 0, o.get_count())
 			{
 				auto& children = childrens[i];
-				for (const auto& child : children)
-				{
-					children2World::solve(l2ws[i], child);
-				}
+				solver.solve(*writes, tk, l2ws[i], children);
 			}
 		});
 }
@@ -196,32 +225,47 @@ task_system::Event Child2WorldSystem(task_system::ecs::pipeline& ppl)
 task_system::Event World2LocalSystem(task_system::ecs::pipeline& ppl)
 {
 	using namespace ecs;
-	filters filter;
-	filter.archetypeFilter = {
-		{complist<LocalToWorld, WorldToLocal>}, //all
-		{}, //any
-		{} //none
-	};
 	def paramList = boost::hana::make_tuple(
 		// write
 		param<WorldToLocal>,
 		// read.
 		param<const LocalToWorld>
 	);
-	return task_system::ecs::schedule(ppl,
-		*ppl.create_pass(filter, paramList),
-		[](const task_system::ecs::pipeline& pipeline, const ecs::pass& pass, const ecs::task& tk)
-		{
-			ZoneScopedN("World2LocalSystem");
-			auto o = operation{ paramList, pass, tk };
-			const float4x4* l2ws = o.get_parameter<const LocalToWorld>();
-			float4x4* w2ls = o.get_parameter<WorldToLocal>();
-
-			forloop(i, 0, o.get_count())
+	const auto inverse = [&ppl](const filters& filter, uint32_t slicePeriod)
+	{
+		auto pass = ppl.create_pass(filter, paramList);
+		if (slicePeriod > 1)
+			ppl.time_slice(*pass, slicePeriod);
+		return task_system::ecs::schedule(ppl, *pass,
+			[](const task_system::ecs::pipeline& pipeline, const ecs::pass& pass, const ecs::task& tk)
 			{
-				w2ls[i] = sakura::math::inverse(l2ws[i]);
-			}
-		});
+				ZoneScopedN("World2LocalSystem");
+				auto o = operation{ paramList, pass, tk };
+				const float4x4* l2ws = o.get_parameter<const LocalToWorld>();
+				float4x4* w2ls = o.get_parameter<WorldToLocal>();
+
+				math::lanes::for_each(o.get_count(), [&](uint32_t i, uint32_t n)
+				{
+					math::lanes::store_float4x4(w2ls + i, math::lanes::inverse(math::lanes::load_float4x4(l2ws + i, n)), n);
+				});
+			});
+	};
+	// Entities moved every frame get their inverse every frame.
+	filters moving;
+	moving.archetypeFilter = {
+		{complist<LocalToWorld, WorldToLocal>}, //all
+		{complist<MoveToward, Heading>}, //any
+		{} //none
+	};
+	inverse(moving, 1);
+	// Inverses of static transforms may lag, a quarter of their chunks is refreshed per frame.
+	filters still;
+	still.archetypeFilter = {
+		{complist<LocalToWorld, WorldToLocal>}, //all
+		{}, //any
+		{complist<MoveToward, Heading>} //none
+	};
+	return inverse(still, 4);
 }
 
 template<class C, class T>
@@ -271,12 +315,11 @@ sakura::Vector3f nearest_position(const sakura::Vector3f& query, const std::vect
 	return result;
 }
 
-auto& get_random_engine()
-{
-	static std::random_device r;
-	static std::default_random_engine el(r());
-	return el;
-}
+// Every random draw of the simulation derives from this seed, runs replay exactly.
+// Systems draw from (frame << 32 | entity id) streams, spawns from streams past any frame.
+constexpr uint64_t SimulationSeed = 0x5A4B3C2D1E0F9788ull;
+constexpr uint64_t TargetSpawnStreams = 0xFFFFFFFFull << 32;
+constexpr uint64_t BoidSpawnStreams = 0xFFFFFFFEull << 32;
 
 task_system::Event RandomTargetSystem(task_system::ecs::pipeline& ppl)
 {
@@ -289,7 +332,11 @@ task_system::Event RandomTargetSystem(task_system::ecs::pipeline& ppl)
 	def paramList = hana::tuple{
 		param<MoveToward>, param<const RandomMoveTarget>, param<const Translation>
 	};
-	return task_system::ecs::schedule(ppl, *ppl.create_pass(filter, paramList), 
+	auto pass = ppl.create_pass(filter, paramList);
+	// Arrivals are checked on a quarter of the movers per frame. Draws are keyed by the
+	// pipeline's frame index, the one the time slices and the target tree follow.
+	ppl.time_slice(*pass, 4);
+	return task_system::ecs::schedule(ppl, *pass,
 		[](const task_system::ecs::pipeline& pipeline, const ecs::pass& pass, const ecs::task& tk)
 		{
 			ZoneScopedN("RandomTargetSystem");
@@ -297,18 +344,19 @@ task_system::Event RandomTargetSystem(task_system::ecs::pipeline& ppl)
 			auto mts = o.get_parameter<MoveToward>();
 			auto trs = o.get_parameter<const Translation>();
 			auto rmts = o.get_parameter<const RandomMoveTarget>();
+			const entity* ents = ctx.get_entities(tk.slice.c) + tk.slice.start;
 			forloop(i, 0, o.get_count())
 			{
 				if (math::subtract(mts[i].Target, trs[i]).is_nearly_zero())
 				{
-					auto sphere = rmts[i];
-					mts[i].Target = sphere.random_point(get_random_engine());
+					math::random_stream rng(SimulationSeed, (uint64_t)(uint32_t)pipeline.frame_index() << 32 | ents[i].id);
+					mts[i].Target = rmts[i].random_point(rng);
 				}
 			}
 		});
 }
 
-task_system::Event MoveTowardSystem(task_system::ecs::pipeline& ppl, float deltaTime)
+task_system::Event MoveTowardSystem(task_system::ecs::pipeline& ppl, const float& deltaTime)
 {
 	using namespace ecs;
 	filters filter;
@@ -319,32 +367,27 @@ task_system::Event MoveTowardSystem(task_system::ecs::pipeline& ppl, float delta
 	def paramList = hana::tuple{
 		param<Translation>, param<const MoveToward>
 	};
-	static std::random_device r;
-	static std::default_random_engine el(r());
 	return task_system::ecs::schedule(ppl, *ppl.create_pass(filter, paramList),
-		[deltaTime](const task_system::ecs::pipeline& pipeline, const ecs::pass& pass, const ecs::task& tk)
+		[&deltaTime](const task_system::ecs::pipeline& pipeline, const ecs::pass& pass, const ecs::task& tk)
 		{
 			ZoneScopedN("MoveTowardSystem");
 			auto o = operation{ paramList, pass, tk };
 			auto mts = o.get_parameter<const MoveToward>();
 			auto trs = o.get_parameter<Translation>();
-			forloop(i, 0, o.get_count())
-				trs[i] = trs[i] + math::normalize(mts[i].Target - trs[i]) * mts[i].MoveSpeed;
+			math::lanes::for_each(o.get_count(), [&](uint32_t i, uint32_t n)
+			{
+				const auto targets = math::lanes::load_float3(&mts[i].Target, n, sizeof(MoveToward));
+				const auto speeds = math::lanes::load_float(&mts[i].MoveSpeed, n, sizeof(MoveToward));
+				const auto positions = math::lanes::load_float3(trs + i, n);
+				const auto direction = math::lanes::normalize(math::lanes::subtract(targets, positions));
+				math::lanes::store_float3(trs + i, math::lanes::multiply_add(direction, speeds, positions), n);
+			});
 		});
 }
-std::atomic<size_t> averageNeighberCount = 0;
-std::atomic<size_t> maxNeighberCount = 0;
-
-template<typename T>
-void update_maximum(std::atomic<T>& maximum_value, T const& value) noexcept
-{
-	T prev_value = maximum_value;
-	while (prev_value < value &&
-		!maximum_value.compare_exchange_weak(prev_value, value))
-	{
-	}
-}
-task_system::Event BoidsSystem(task_system::ecs::pipeline& ppl, float deltaTime)
+// Recorded by every boid on its worker's slot, read once per frame.
+task_system::sharded_stat<size_t> neighberCounts;
+task_system::sharded_histogram<11> neighberHistogram(0.0, 11.0);
+task_system::Event BoidsSystem(task_system::ecs::pipeline& ppl, const float& deltaTime)
 {
 	using namespace ecs;
 	filters boidFilter;
@@ -356,9 +399,10 @@ task_system::Event BoidsSystem(task_system::ecs::pipeline& ppl, float deltaTime)
 		complist<Boid> //shared
 	};
 	//构造 kdtree, 提取 headings
-	auto positions = make_resource<std::vector<BoidPosition>>();
-	auto headings = make_resource<std::vector<sakura::Vector3f>>();
-	auto kdtree = make_resource<core::algo::kdtree<BoidPosition>>();
+	//缓冲区按名字常驻, 重新录制时沿用上次的容量
+	auto positions = ppl.persistent_resource<std::vector<BoidPosition>>("Boids.Positions");
+	auto headings = ppl.persistent_resource<std::vector<sakura::Vector3f>>("Boids.Headings");
+	auto kdtree = ppl.persistent_resource<core::algo::kdtree<BoidPosition>>("Boids.KDTree");
 	{
 		auto copyPositionJob = CopyComponent<Translation>(ppl, boidFilter, positions);
 		CopyComponent<Heading>(ppl, boidFilter, headings);
@@ -366,13 +410,13 @@ task_system::Event BoidsSystem(task_system::ecs::pipeline& ppl, float deltaTime)
 		task_system::ecs::schedule_custom(ppl, *ppl.create_custom_pass(shareList), [positions, kdtree]() mutable
 			{
 				ZoneScopedN("Build Boid KDTree");
-				kdtree->initialize(std::move(*positions));
+				kdtree->initialize(*positions);
 			});
 	}
 
 	//收集目标和障碍物
-	auto targets = make_resource<std::vector<BoidPosition>>();
-	auto targetTree = make_resource<core::algo::kdtree<BoidPosition>>();
+	auto targets = ppl.persistent_resource<std::vector<BoidPosition>>("Boids.Targets");
+	auto targetTree = ppl.persistent_resource<core::algo::kdtree<BoidPosition>>("Boids.TargetTree");
 	{
 		filters targetFilter;
 		targetFilter.archetypeFilter =
@@ -381,21 +425,26 @@ task_system::Event BoidsSystem(task_system::ecs::pipeline& ppl, float deltaTime)
 		};
 		CopyComponent<Translation>(ppl, targetFilter, targets);
 		shared_entry shareList[] = { read(targets), write(targetTree) };
-		task_system::ecs::schedule_custom(ppl, *ppl.create_custom_pass(shareList), [targets, targetTree]() mutable
+		// Targets move slowly, the tree is rebuilt every few frames. The pipeline's frame
+		// index keeps counting when the systems are recorded again.
+		constexpr uint32_t TargetTreePeriod = 4;
+		task_system::ecs::schedule_custom(ppl, *ppl.create_custom_pass(shareList), [&ppl, targets, targetTree]() mutable
 			{
+				if (ppl.frame_index() % TargetTreePeriod != 0 && targetTree->size() == targets->size())
+					return;
 				ZoneScopedN("Build Target KDTree");
-				targetTree->initialize(std::move(*targets));
+				targetTree->initialize(*targets);
 			});
 	}
 	//计算新的朝向
-	auto newHeadings = make_resource<chunk_vector<sakura::Vector3f>>();
+	auto newHeadings = ppl.persistent_resource<chunk_vector<sakura::Vector3f>>("Boids.NewHeadings");
 	{
 		shared_entry shareList[] = { read(kdtree), read(headings), read(targetTree), write(newHeadings) };
 		def paramList = hana::tuple{ param<const Heading>, param<const Translation>, param<const Boid> };
 		auto pass = ppl.create_pass(boidFilter, paramList, shareList);
 		newHeadings->resize(pass->entityCount);
 		task_system::ecs::schedule(ppl, *pass,
-			[headings, kdtree, targetTree, newHeadings, deltaTime](const task_system::ecs::pipeline& pipeline, const ecs::pass& pass, const ecs::task& tk) mutable
+			[headings, kdtree, targetTree, newHeadings, &deltaTime](const task_system::ecs::pipeline& pipeline, const ecs::pass& pass, const ecs::task& tk) mutable
 			{
 				ZoneScopedN("Boid Main");
 				auto o = operation{ paramList, pass, tk };
@@ -403,14 +452,13 @@ task_system::Event BoidsSystem(task_system::ecs::pipeline& ppl, float deltaTime)
 				auto hds = o.get_parameter_owned<const Heading>();
 				auto trs = o.get_parameter_owned<const Translation>();
 				auto boid = o.get_parameter<const Boid>(); //这玩意是 shared
-				std::vector<std::pair<float, int>> neighbers;
+				// 临时数据放在当前 worker 的帧内存上, 帧结束统一回收
+				auto& scratch = pipeline.local_scratch();
+				task_system::ecs::scratch_vector<std::pair<float, int>> neighbers(scratch);
 				neighbers.reserve(10);
-				chunk_vector<sakura::Vector3f> alignments;
-				chunk_vector<sakura::Vector3f> separations;
-				chunk_vector<sakura::Vector3f> targetings;
-				alignments.resize(o.get_count());
-				separations.resize(o.get_count());
-				targetings.resize(o.get_count());
+				task_system::ecs::scratch_vector<sakura::Vector3f> alignments(o.get_count(), scratch);
+				task_system::ecs::scratch_vector<sakura::Vector3f> separations(o.get_count(), scratch);
+				task_system::ecs::scratch_vector<sakura::Vector3f> targetings(o.get_count(), scratch);
 				{
 					ZoneScopedN("Collect Neighbors");
 					forloop(i, 0, o.get_count())
@@ -425,8 +473,8 @@ task_system::Event BoidsSystem(task_system::ecs::pipeline& ppl, float deltaTime)
 							alignments[i] = alignments[i] + (*headings)[ng.second];
 							separations[i] = separations[i] + (*kdtree)[ng.second].value;
 						}
-						averageNeighberCount += neighbers.size();
-						update_maximum(maxNeighberCount, neighbers.size());
+						neighberCounts.record(neighbers.size());
+						neighberHistogram.record((double)neighbers.size());
 					}
 				}
 
@@ -458,7 +506,7 @@ task_system::Event BoidsSystem(task_system::ecs::pipeline& ppl, float deltaTime)
 		shared_entry shareList[] = { read(newHeadings) };
 		def paramList = hana::tuple{ param<Heading>, param<Translation>, param<const Boid> };
 		return task_system::ecs::schedule(ppl, *ppl.create_pass(boidFilter, paramList, shareList),
-			[newHeadings, deltaTime](const task_system::ecs::pipeline& pipeline, const ecs::pass& pass, const ecs::task& tk)
+			[newHeadings, &deltaTime](const task_system::ecs::pipeline& pipeline, const ecs::pass& pass, const ecs::task& tk)
 			{
 				ZoneScopedN("Apply Boid");
 				auto o = operation{ paramList, pass, tk };
@@ -483,11 +531,17 @@ int main()
 		return -1;
 	}
 	render_system::initialize();
+	plot_counters_to_tracy();
 
 	using namespace sakura::ecs;
 
 	register_components<Translation, Rotation, RotationEuler, Scale, LocalToWorld, LocalToParent, 
 		WorldToLocal, Child, Parent, Boid, BoidTarget, MoveToward, RandomMoveTarget, Heading>();
+
+	// 先启动调度器, 生成实体时并行初始化
+	task_system::Scheduler scheduler(task_system::Scheduler::Config::allCores());
+	scheduler.bind();
+	defer(scheduler.unbind());  // Automatically unbind before returning.3
 	
 	{	
 		//创建 Boid 目标
@@ -495,21 +549,22 @@ int main()
 		{
 			complist<BoidTarget, Translation, LocalToWorld, MoveToward, RandomMoveTarget>
 		};
-		for (auto slice : ctx.allocate(type, 500))
+		task_system::ecs::spawn(ctx, type, 500, [](const chunk_slice& slice, uint32_t index)
 		{
+			// 每个 slice 独立的随机流, 可以并行初始化
+			math::random_stream rng(SimulationSeed, TargetSpawnStreams | index);
 			auto trs = init_component<Translation>(ctx, slice);
 			auto mts = init_component<MoveToward>(ctx, slice);
 			auto rmts = init_component<RandomMoveTarget>(ctx, slice);
 			forloop(i, 0, slice.count)
 			{
-				std::uniform_real_distribution<float> speedDst(15.f, 25.f);
 				rmts[i].center = Vector3f::vector_zero();
 				rmts[i].radius = 1000.f;
-				mts[i].Target = rmts[i].random_point(get_random_engine());
-				mts[i].MoveSpeed = speedDst(get_random_engine());
-				trs[i] = rmts[i].random_point(get_random_engine());
+				mts[i].Target = rmts[i].random_point(rng);
+				mts[i].MoveSpeed = rng.uniform(15.f, 25.f);
+				trs[i] = rmts[i].random_point(rng);
 			}
-		}
+		});
 	}
 	entity e;
 	{
@@ -538,77 +593,113 @@ int main()
 		sphere s;
 		s.center = Vector3f::vector_zero();
 		s.radius = 1000.f;
-		for (auto slice : ctx.allocate(type, 10000))
+		task_system::ecs::spawn(ctx, type, 10000, [&s](const chunk_slice& slice, uint32_t index)
 		{
+			// Seven samples per boid (heading, then position), drawn four blocks at a time.
+			constexpr uint32_t SamplesPerBoid = 7;
+			sakura::vector<float> samples(slice.count * SamplesPerBoid);
+			math::fill_uniform(SimulationSeed, BoidSpawnStreams | index, 0, samples.data(), (uint32_t)samples.size());
 			auto trs = init_component<Translation>(ctx, slice);
 			auto hds = init_component<Heading>(ctx, slice);
 			forloop(i, 0, slice.count)
 			{
-				std::uniform_real_distribution<float> uniform_dist(0, 1);
-				auto& el = get_random_engine();
-				sakura::Vector3f vector{ uniform_dist(el), uniform_dist(el), uniform_dist(el) };
+				const float* u = samples.data() + i * SamplesPerBoid;
+				sakura::Vector3f vector{ u[0], u[1], u[2] };
 				hds[i] = math::normalize(vector);
-				trs[i] = s.random_point(el);
+				trs[i] = s.point_at(u + 3);
 			}
-		}
+		});
 	}
 	
-	task_system::Scheduler scheduler(task_system::Scheduler::Config::allCores());
-	scheduler.bind();
-	defer(scheduler.unbind());  // Automatically unbind before returning.3
 	Timer timer; 
-	double deltaTime = 0;
-	while(sakura::Core::yield())
+	float deltaTime = 0;
+	task_system::ecs::adaptive_schedule adaptive;
+	// The renderer reads nothing from the world, so it can draw while the frame
+	// simulates. A renderer reading simulation data would need copies of it taken
+	// at the end of each frame before it could overlap.
+	constexpr bool OverlapRender = true;
+	// Systems are recorded once, frames only replay the compiled graph.
+	task_system::ecs::compiled_pipeline frame(ctx, [&](task_system::ecs::pipeline& ppl)
 	{
-		ZoneScoped;
-
-		timer.start_up();
-		task_system::ecs::pipeline ppl(ctx);
-		ppl.inc_timestamp();
-		ppl.on_sync = [&](gsl::span<custom_pass*> dependencies)
+		ZoneScopedN("Record Systems");
+		ppl.adaptive = &adaptive;
+		ppl.on_sync = [&ppl](gsl::span<custom_pass*> dependencies)
 		{
 			for(auto dp : dependencies)
 				ppl.pass_events[dp->passIndex].wait();
 		};
+		RotationEulerSystem(ppl);
+
+		RandomTargetSystem(ppl);
+		MoveTowardSystem(ppl, deltaTime);
+		BoidsSystem(ppl, deltaTime);
+		HeadingSystem(ppl);
+
+		filters wrd_filter;
+		wrd_filter.archetypeFilter = {
+			{complist<LocalToWorld>},
+			{complist<Translation, Scale, Rotation>},
+			{complist<LocalToParent, Parent>}
+		};
+		Local2XSystem<LocalToWorld>(ppl, wrd_filter);
+
+		filters c2p_filter;
+		c2p_filter.archetypeFilter = {
+			{complist<LocalToParent, Parent>},
+			{complist<Translation, Scale, Rotation>},
+			{}
+		};
+		Local2XSystem<LocalToParent>(ppl, c2p_filter);
+		Child2WorldSystem(ppl);
+		World2LocalSystem(ppl);
+	});
+	uint64_t resourcesCreated = 0;
+	while(sakura::Core::yield())
+	{
+		ZoneScoped;
+
+		timer.start_up();
 		{
 			ZoneScopedN("Schedule Systems")
-			RotationEulerSystem(ppl);
-
-			RandomTargetSystem(ppl);
-			MoveTowardSystem(ppl, deltaTime);
-			BoidsSystem(ppl, deltaTime);
-			HeadingSystem(ppl);
-
-			filters wrd_filter;
-			wrd_filter.archetypeFilter = {
-				{complist<LocalToWorld>},
-				{complist<Translation, Scale, Rotation>},
-				{complist<LocalToParent, Parent>}
-			};
-			Local2XSystem<LocalToWorld>(ppl, wrd_filter);
-
-			filters c2p_filter;
-			c2p_filter.archetypeFilter = {
-				{complist<LocalToParent, Parent>},
-				{complist<Translation, Scale, Rotation>},
-				{}
-			};
-			Local2XSystem<LocalToParent>(ppl, c2p_filter);
-			Child2WorldSystem(ppl);
-			World2LocalSystem(ppl);
+			frame.run();
+		}
+		if constexpr (OverlapRender)
+		{
+			ZoneScopedN("Render System")
+			render_system::RenderSystem();
 		}
 		
 		{
 			ZoneScopedN("Pipeline Sync")
 			// 等待pipeline
-			ppl.wait();
+			frame.wait();
+		}
+		if constexpr (!OverlapRender)
+		{
+			ZoneScopedN("Render System")
+			render_system::RenderSystem();
+		}
+		TracyPlot("Pass Prologue Wait (ns)", (int64_t)frame.get().prologue_wait_time());
+		TracyPlot("Pass Schedule Overhead (ns)", (int64_t)frame.get().schedule_overhead_time());
+		TracyPlot("Unchanged Entities Skipped", (int64_t)frame.get().changes().skippedEntities);
+		TracyPlot("Time-Sliced Entities Deferred", (int64_t)frame.get().deferred_entities());
+		{
+			// Pooled resources are only created by the first recording.
+			const uint64_t created = frame.resources.created();
+			TracyPlot("Shared Resources Created", (int64_t)(created - resourcesCreated));
+			resourcesCreated = created;
 		}
+		{
+			const auto peaks = frame.scratch.high_water();
+			TracyPlot("Frame Scratch Peak (bytes)", (int64_t)(peaks.empty() ? 0 : *std::max_element(peaks.begin(), peaks.end())));
+			TracyPlot("Frame Scratch Reserved (bytes)", (int64_t)frame.scratch.capacity());
+		}
+
+		neighberCounts.publish("Boid Neighbors Average", "Boid Neighbors Max");
+		neighberHistogram.publish("Boid Neighbors P90", 0.9);
 
 		//std::cout << "delta time: " << deltaTime * 1000 << std::endl;
-		//std::cout << "average neighbor count: " << averageNeighberCount / 50000 << std::endl;
-		//std::cout << "maximum neighbor count: " << maxNeighberCount << std::endl;
-		//averageNeighberCount.store(0);
-		deltaTime = timer.end();
+		deltaTime = (float)timer.end();
 
 		FrameMark;
 	}
@@ -2,7 +2,7 @@
 #include "ECS/ECS.h"
 #include "Math/Math.hpp"
 #include <cmath>
-#include <random>
+#include "Math/Random.h"
 
 using namespace core::guid_parse::literals;
 namespace ecs = sakura::ecs;
@@ -42,14 +42,19 @@ struct sphere
 	sakura::Vector3f center;
 	float radius;
 
-	template <class E>
-	sakura::Vector3f random_point(E& el)
+	// Point from four uniform samples in [0, 1).
+	sakura::Vector3f point_at(const float* u) const
 	{
-		std::uniform_real_distribution<float> uniform_dist(0, 1);
-		sakura::Vector3f vector{ uniform_dist(el), uniform_dist(el), uniform_dist(el) };
-		float scale = std::cbrt(uniform_dist(el)) * radius;
+		sakura::Vector3f vector{ u[0], u[1], u[2] };
+		float scale = std::cbrt(u[3]) * radius;
 		return center + vector * scale;
 	}
+
+	sakura::Vector3f random_point(sakura::math::random_stream& rng) const
+	{
+		const float u[4] = { rng.uniform(), rng.uniform(), rng.uniform(), rng.uniform() };
+		return point_at(u);
+	}
 };
 
 struct RandomMoveTarget
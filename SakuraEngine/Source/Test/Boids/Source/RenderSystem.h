@@ -196,11 +196,12 @@ namespace render_system
 	using Rotator = sakura::Rotator;
 	using float4x4 = sakura::float4x4;
 	using IModule = sakura::IModule;
-	task_system::Event RenderSystem(task_system::ecs::pipeline& ppl, float deltaTime)
+	// Submits one frame. Runs on the main thread while the next frame simulates, so
+	// it must not touch the world: the sample pass only draws its test triangle.
+	void RenderSystem()
 	{
 		using namespace sakura;
 		using namespace sakura::graphics;
-		using namespace ecs;
 
 		RenderPass* pass_ptr = render_graph.render_pass(pass);
 		pass_ptr->construct(render_graph.builder(pass));
@@ -208,24 +209,5 @@ namespace render_system
 		{		
 			deviceGroup.present(swapChain);
 		}
-
-		filters filter;
-		filter.archetypeFilter = {
-			{complist<LocalToWorld, WorldToLocal>}, //all
-			{}, //any
-			{} //none
-		};
-		static constexpr auto paramList = boost::hana::make_tuple(
-			// write
-			param<WorldToLocal>,
-			// read.
-			param<const LocalToWorld>
-		);
-		return task_system::ecs::schedule(ppl, *ppl.create_pass(filter, paramList),
-			[](const task_system::ecs::pipeline& pipeline, const ecs::pass& pass, const ecs::task& tk)
-			{
-				auto o = operation{ paramList, pass, tk };
-				
-			});
 	}
 }
\ No newline at end of file
@@ -15,22 +15,23 @@ namespace core
 			using Distance = typename Point::value_type;
 		public:
 			kdtree() {}
-			kdtree(std::vector<Point>&& points)
-				: points(points) 
+			kdtree(std::vector<Point>&& inPoints)
+				: points(std::move(inPoints))
 			{
-				std::vector<int> indices(points.size());
-				std::iota(indices.begin(), indices.end(), 0);
-				nodes.resize(points.size());
-				build_resursive_multithread(indices, 0, 0);
+				build();
 			}
 
 			void initialize(std::vector<Point>&& inPoints)
 			{
 				points = std::move(inPoints);
-				std::vector<int> indices(points.size());
-				std::iota(indices.begin(), indices.end(), 0);
-				nodes.resize(points.size());
-				build_resursive_multithread(indices, 0, 0);
+				build();
+			}
+
+			// Copies the points so the source keeps its storage for the next frame.
+			void initialize(const std::vector<Point>& inPoints)
+			{
+				points.assign(inPoints.begin(), inPoints.end());
+				build();
 			}
 			
 			const Point& operator[](size_t i) const
@@ -38,6 +39,19 @@ namespace core
 				return points[i];
 			}
 
+			size_t size() const
+			{
+				return points.size();
+			}
+
+			void build()
+			{
+				buildIndices.resize(points.size());
+				std::iota(buildIndices.begin(), buildIndices.end(), 0);
+				nodes.resize(points.size());
+				build_multithread();
+			}
+
 			void search_radius(const Point& query, Distance radius, std::vector<int>& indices) const
 			{
 				if (nodes.empty())
@@ -45,7 +59,9 @@ namespace core
 				search_radius_recursive(query, &nodes[0], indices, radius * radius);
 			}
 			using sorted_vec = std::vector<std::pair<Distance, int>>;
-			void search_k_radius(const Point& query, Distance radius, int k, sorted_vec& indices) const
+			// Any vector of (distance, index) pairs, whatever its allocator.
+			template<class Vec = sorted_vec>
+			void search_k_radius(const Point& query, Distance radius, int k, Vec& indices) const
 			{
 				if (nodes.empty())
 					return;
@@ -68,13 +84,62 @@ namespace core
 				int axis = -1;
 			};
 
-			node* build_resursive_multithread(gsl::span<int> indices, int depth, int id)
+			// Indices [begin, begin + size) of buildIndices, rooted at nodes[id].
+			struct build_range
+			{
+				int begin;
+				int size;
+				int depth;
+				int id;
+			};
+			// Ranges smaller than this are built as a whole subtree by one task.
+			static constexpr int ParallelBuildSize = 500;
+
+			// The split of a range and the ids of its children only depend on its size,
+			// so the work is known level by level: the large ranges of a level are
+			// partitioned in parallel, then the subtrees left below ParallelBuildSize
+			// are built in parallel. No task per node, no event, the range lists keep
+			// their capacity between builds.
+			void build_multithread()
 			{
 				ZoneScoped;
-				if (indices.empty())
-					return nullptr;
-				if (indices.size() < 500)
-					return build_recursive(indices , depth, id);
+				levelRanges.clear();
+				subtrees.clear();
+				if (!buildIndices.empty())
+					levelRanges.push_back({ 0, (int)buildIndices.size(), 0, 0 });
+				while (!levelRanges.empty())
+				{
+					nextRanges.clear();
+					const auto split = std::partition(levelRanges.begin(), levelRanges.end(),
+						[](const build_range& r) { return r.size >= ParallelBuildSize; });
+					subtrees.insert(subtrees.end(), split, levelRanges.end());
+					levelRanges.erase(split, levelRanges.end());
+					sakura::task_system::parallel_for((uint32_t)levelRanges.size(), 1, [this](uint32_t i)
+						{
+							const build_range& r = levelRanges[i];
+							split_node({ buildIndices.data() + r.begin, (size_t)r.size }, r.depth, r.id);
+						});
+					for (const auto& r : levelRanges)
+					{
+						const int mid = (r.size - 1) / 2;
+						if (mid > 0)
+							nextRanges.push_back({ r.begin, mid, r.depth + 1, r.id + 1 });
+						if (r.size - mid - 1 > 0)
+							nextRanges.push_back({ r.begin + mid + 1, r.size - mid - 1, r.depth + 1, r.id + 1 + mid });
+					}
+					std::swap(levelRanges, nextRanges);
+				}
+				sakura::task_system::parallel_for((uint32_t)subtrees.size(), 1, [this](uint32_t i)
+					{
+						const build_range& r = subtrees[i];
+						build_recursive({ buildIndices.data() + r.begin, (size_t)r.size }, r.depth, r.id);
+					});
+			}
+
+			// Partitions indices around their median on the axis of depth and fills
+			// nodes[id], whose children are rooted at id + 1 and id + 1 + mid.
+			node& split_node(gsl::span<int> indices, int depth, int id)
+			{
 				const int axis = depth % Point::dim;
 				const size_t mid = (indices.size() - 1) / 2;
 				std::nth_element(indices.begin(), indices.begin() + mid, indices.end(), [&](int lhs, int rhs)
@@ -84,39 +149,19 @@ namespace core
 				node& n = nodes[id];
 				n.index = indices[mid];
 				n.axis = axis;
-				sakura::task_system::Event taska{ sakura::task_system::Event::Mode::Manual };
-				sakura::task_system::Event taskb{ sakura::task_system::Event::Mode::Manual };
-				sakura::task_system::schedule(
-					[&] {
-						n.children[0] = build_resursive_multithread({ indices.data(), mid }, depth + 1, id + 1);
-						taska.signal();
-					}
-				);
-				sakura::task_system::schedule(
-					[&] {
-						n.children[1] = build_resursive_multithread({ indices.data() + mid + 1, indices.size() - mid - 1 }, depth + 1, id + 1 + mid);
-						taskb.signal();
-					}
-				);
-				taska.wait(); taskb.wait();
-				return &n;
+				n.children[0] = mid > 0 ? &nodes[id + 1] : nullptr;
+				n.children[1] = indices.size() - mid - 1 > 0 ? &nodes[id + 1 + mid] : nullptr;
+				return n;
 			}
 
 			node* build_recursive(gsl::span<int> indices, int depth, int id)
 			{
 				if (indices.empty())
 					return nullptr;
-				const int axis = depth % Point::dim;
+				node& n = split_node(indices, depth, id);
 				const size_t mid = (indices.size() - 1) / 2;
-				std::nth_element(indices.begin(), indices.begin() + mid, indices.end(), [&](int lhs, int rhs)
-					{
-						return points[lhs][axis] < points[rhs][axis];
-					});
-				node& n = nodes[id];
-				n.index = indices[mid];
-				n.axis = axis;
-				n.children[0] = build_recursive({ indices.data(), mid }, depth + 1, id + 1);
-				n.children[1] = build_recursive({ indices.data() + mid + 1, indices.size() - mid - 1 }, depth + 1, id + 1 + mid);
+				build_recursive({ indices.data(), mid }, depth + 1, id + 1);
+				build_recursive({ indices.data() + mid + 1, indices.size() - mid - 1 }, depth + 1, id + 1 + mid);
 				return &n;
 			}
 
@@ -143,7 +188,8 @@ namespace core
 				if(axisDist * axisDist < sradius) // crossing
 					search_radius_recursive(query, n->children[1 - child], indices, sradius);
 			}
-			void search_k_radius_recursive(const Point& query, const node* n, sorted_vec& queue, Distance sradius, int k) const
+			template<class Vec>
+			void search_k_radius_recursive(const Point& query, const node* n, Vec& queue, Distance sradius, int k) const
 			{
 				if (n == nullptr)
 					return;
@@ -184,6 +230,11 @@ namespace core
 			}
 			std::vector<node> nodes;
 			std::vector<Point> points;
+			// Kept between builds so a rebuilt tree does not allocate.
+			std::vector<int> buildIndices;
+			std::vector<build_range> levelRanges;
+			std::vector<build_range> nextRanges;
+			std::vector<build_range> subtrees;
 		};
 	}
 }
\ No newline at end of file
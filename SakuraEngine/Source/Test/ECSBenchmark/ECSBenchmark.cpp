@@ -0,0 +1,522 @@
+#include "TransformComponents.h"
+#include "ECS/ChangeQueue.h"
+#include "ECS/EntityLookup.h"
+#include "ECS/Hierarchy.h"
+#include "ECS/RandomWrites.h"
+#include "ECS/Snapshot.h"
+#include "ECS/Spawn.h"
+#include "TaskSystem/TaskSystem.h"
+#include "RuntimeCore/RuntimeCore.h"
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+
+#define forloop(i, z, n) for(auto i = std::decay_t<decltype(n)>(z); i<(n); ++i)
+#define def static constexpr auto
+
+namespace task_system = sakura::task_system;
+using float4x4 = sakura::float4x4;
+using IModule = sakura::IModule;
+
+// Transform propagation over 1M-node hierarchies: recursive walk from the roots
+// (the original Child2WorldSystem) against level-ordered propagation and against
+// the recursive walk with its writes deferred, whose result is checked against a
+// serial walk.
+namespace hierarchy_benchmark
+{
+	using namespace sakura::ecs;
+	constexpr uint32_t NodeCount = 1'000'000;
+	constexpr uint32_t WarmupFrames = 3;
+	constexpr uint32_t MeasuredFrames = 20;
+
+	// Every root gets nodesPerRoot - 1 descendants: all direct children when wide, a single chain when deep.
+	// Returns every node, roots first.
+	sakura::vector<entity> build(world& ctx, uint32_t rootCount, bool deep)
+	{
+		const uint32_t nodesPerRoot = NodeCount / rootCount;
+		const auto allocate = [&](const entity_type& type, uint32_t count)
+		{
+			sakura::vector<entity> ents;
+			ents.reserve(count);
+			for (auto c : ctx.allocate(type, count))
+			{
+				const entity* es = ctx.get_entities(c.c);
+				ents.insert(ents.end(), es + c.start, es + c.start + c.count);
+			}
+			return ents;
+		};
+		// Offsets differ per node, so that a write landing on the wrong entity shows.
+		const auto offset = [](uint32_t i) { return sakura::math::make_transform(sakura::Vector3f(std::array<float, 3>{ float(i % 13), 1.f, 0.f })); };
+		uint32_t linked = 0;
+		const auto link = [&](entity parent, entity child)
+		{
+			auto children = (value_type_t<Child>)ctx.get_owned_rw(parent, cid<Child>);
+			children.push(child);
+			*(value_type_t<Parent>)ctx.get_owned_rw(child, cid<Parent>) = parent;
+			*(value_type_t<LocalToParent>)ctx.get_owned_rw(child, cid<LocalToParent>) = offset(linked++);
+		};
+		const auto roots = allocate(entity_type{ complist<LocalToWorld, Child> }, rootCount);
+		const uint32_t inner = deep ? nodesPerRoot - 2 : 0;
+		const uint32_t leaves = deep ? 1 : nodesPerRoot - 1;
+		const auto inners = allocate(entity_type{ complist<LocalToWorld, LocalToParent, Parent, Child> }, rootCount * inner);
+		const auto leafs = allocate(entity_type{ complist<LocalToWorld, LocalToParent, Parent> }, rootCount * leaves);
+		forloop(r, 0u, rootCount)
+		{
+			*(value_type_t<LocalToWorld>)ctx.get_owned_rw(roots[r], cid<LocalToWorld>) = offset(r);
+			entity parent = roots[r];
+			forloop(i, 0u, inner)
+			{
+				const entity node = inners[r * inner + i];
+				link(parent, node);
+				parent = node;
+			}
+			forloop(i, 0u, leaves)
+				link(parent, leafs[r * leaves + i]);
+		}
+		sakura::vector<entity> nodes(roots.begin(), roots.end());
+		nodes.insert(nodes.end(), inners.begin(), inners.end());
+		nodes.insert(nodes.end(), leafs.begin(), leafs.end());
+		return nodes;
+	}
+
+	struct children2World
+	{
+		static void solve(world& ctx, const float4x4& parent_l2w, const entity e)
+		{
+			auto child_l2w = static_cast<float4x4*>(ctx.get_owned_rw(e, cid<LocalToWorld>));
+			const auto child_l2p = static_cast<const float4x4*>(ctx.get_owned_ro(e, cid<LocalToParent>));
+			if (!child_l2w || !child_l2p)
+				return;
+			*child_l2w = sakura::math::multiply(parent_l2w, *child_l2p);
+			if (auto children = ctx.get_owned_ro(e, cid<Child>))
+				for (auto& child : value_type_t<Child>(children))
+					solve(ctx, *child_l2w, child);
+		}
+
+		// Same walk, the writes land once the pass is done: children are solved from
+		// the transform computed here, never from a value another task writes.
+		static void solve(world& ctx, task_system::ecs::random_writes& writes, const task& tk, const float4x4& parent_l2w, const entity e)
+		{
+			const auto child_l2p = static_cast<const float4x4*>(ctx.get_owned_ro(e, cid<LocalToParent>));
+			if (!child_l2p)
+				return;
+			const float4x4 child_l2w = sakura::math::multiply(parent_l2w, *child_l2p);
+			writes.write<LocalToWorld>(tk, e, child_l2w);
+			if (auto children = ctx.get_owned_ro(e, cid<Child>))
+				for (auto& child : value_type_t<Child>(children))
+					solve(ctx, writes, tk, child_l2w, child);
+		}
+	};
+
+	filters root_filter()
+	{
+		filters filter;
+		filter.archetypeFilter = {
+			{complist<Child, LocalToWorld>},
+			{},
+			{complist<Parent, LocalToParent>} // from root
+		};
+		return filter;
+	}
+
+	task_system::Event recursive_system(task_system::ecs::pipeline& ppl)
+	{
+		def paramList = boost::hana::make_tuple(param<LocalToWorld>, param<const Child>);
+		return task_system::ecs::schedule(ppl, *ppl.create_pass(root_filter(), paramList),
+			[](const task_system::ecs::pipeline& pipeline, const pass& pass, const task& tk)
+			{
+				auto o = operation{ paramList, pass, tk };
+				const auto childrens = o.get_parameter<const Child>();
+				float4x4* l2ws = o.get_parameter<LocalToWorld>();
+				forloop(i, 0, o.get_count())
+					for (const auto& child : childrens[i])
+						children2World::solve(pipeline.ctx, l2ws[i], child);
+			});
+	}
+
+	task_system::Event deferred_system(task_system::ecs::pipeline& ppl, task_system::ecs::random_writes& writes)
+	{
+		def paramList = boost::hana::make_tuple(param<const LocalToWorld>, param<const Child>);
+		auto walk = ppl.create_pass(root_filter(), paramList);
+		ppl.defer_random_writes(*walk, writes);
+		return task_system::ecs::schedule(ppl, *walk,
+			[&writes](const task_system::ecs::pipeline& pipeline, const pass& pass, const task& tk)
+			{
+				auto o = operation{ paramList, pass, tk };
+				const auto childrens = o.get_parameter<const Child>();
+				const float4x4* l2ws = o.get_parameter<const LocalToWorld>();
+				forloop(i, 0, o.get_count())
+					for (const auto& child : childrens[i])
+						children2World::solve(pipeline.ctx, writes, tk, l2ws[i], child);
+			});
+	}
+
+	task_system::Event level_system(task_system::ecs::pipeline& ppl, task_system::ecs::hierarchy_levels& hierarchy)
+	{
+		filters filter;
+		filter.archetypeFilter = {
+			{complist<LocalToWorld, LocalToParent, Parent>}
+		};
+		def paramList = boost::hana::make_tuple(param<LocalToWorld>, param<const LocalToParent>, param<const Parent>);
+		auto pass = ppl.create_pass(filter, paramList);
+		return task_system::ecs::schedule_custom(ppl, *pass, [&ppl, pass, &hierarchy]()
+			{
+				hierarchy.refresh(ppl, *pass);
+				hierarchy.propagate();
+			});
+	}
+
+	enum class propagation { recursive, levels, deferred };
+
+	// Average milliseconds of one propagation frame.
+	double measure(world& ctx, propagation method)
+	{
+		task_system::ecs::hierarchy_levels hierarchy(cid<Parent>, cid<LocalToWorld>, cid<LocalToParent>);
+		task_system::ecs::random_writes writes(ctx);
+		task_system::ecs::compiled_pipeline frame(ctx, [&](task_system::ecs::pipeline& ppl)
+		{
+			ppl.on_sync = [&ppl](gsl::span<custom_pass*> dependencies)
+			{
+				for (auto dp : dependencies)
+					ppl.pass_events[dp->passIndex].wait();
+			};
+			switch (method)
+			{
+			case propagation::recursive: recursive_system(ppl); break;
+			case propagation::levels: level_system(ppl, hierarchy); break;
+			case propagation::deferred: deferred_system(ppl, writes); break;
+			}
+		});
+		forloop(i, 0u, WarmupFrames)
+		{
+			frame.run();
+			frame.wait();
+		}
+		const auto start = std::chrono::steady_clock::now();
+		forloop(i, 0u, MeasuredFrames)
+		{
+			frame.run();
+			frame.wait();
+		}
+		const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		return elapsed.count() / MeasuredFrames;
+	}
+
+	// LocalToWorld of every node, propagated on this thread.
+	sakura::vector<float4x4> serial_walk(world& ctx, const sakura::vector<entity>& nodes)
+	{
+		for (auto e : nodes)
+			if (!ctx.get_owned_ro(e, cid<Parent>))
+				for (auto& child : value_type_t<Child>(ctx.get_owned_ro(e, cid<Child>)))
+					children2World::solve(ctx, *(const float4x4*)ctx.get_owned_ro(e, cid<LocalToWorld>), child);
+		sakura::vector<float4x4> result;
+		result.reserve(nodes.size());
+		for (auto e : nodes)
+			result.push_back(*(const float4x4*)ctx.get_owned_ro(e, cid<LocalToWorld>));
+		return result;
+	}
+
+	// Nodes whose LocalToWorld differs from expected, bit for bit.
+	uint32_t mismatches(world& ctx, const sakura::vector<entity>& nodes, const sakura::vector<float4x4>& expected)
+	{
+		uint32_t count = 0;
+		forloop(i, 0u, (uint32_t)nodes.size())
+			if (std::memcmp(ctx.get_owned_ro(nodes[i], cid<LocalToWorld>), &expected[i], sizeof(float4x4)) != 0)
+				count++;
+		return count;
+	}
+
+	// False if the deferred walk disagrees with the serial one.
+	bool run()
+	{
+		bool matched = true;
+		struct shape { const char* name; uint32_t roots; bool deep; };
+		const shape shapes[] = {
+			{ "wide (1000 roots x 999 children)", 1000, false },
+			// The recursive walk puts one stack frame per level, so chains stay at 1000 levels.
+			{ "deep (1000 chains x 1000 levels)", 1000, true }
+		};
+		for (const auto& s : shapes)
+		{
+			auto ctx = std::make_unique<world>();
+			const auto nodes = build(*ctx, s.roots, s.deep);
+			const auto expected = serial_walk(*ctx, nodes);
+			const double recursive = measure(*ctx, propagation::recursive);
+			const double levels = measure(*ctx, propagation::levels);
+			// Cleared first, so that only the deferred writes can restore the transforms.
+			for (auto e : nodes)
+				if (ctx->get_owned_ro(e, cid<Parent>))
+					std::memset(ctx->get_owned_rw(e, cid<LocalToWorld>), 0, sizeof(float4x4));
+			const double deferred = measure(*ctx, propagation::deferred);
+			const uint32_t wrong = mismatches(*ctx, nodes, expected);
+			matched &= wrong == 0;
+			std::cout << "Hierarchy " << s.name << ": recursive " << recursive << " ms, levels " << levels
+				<< " ms (" << recursive / levels << "x), deferred writes " << deferred << " ms, "
+				<< wrong << " nodes differ from the serial walk" << std::endl;
+		}
+		return matched;
+	}
+}
+
+// Saving a 2M-entity scene and loading it back into an empty world.
+namespace snapshot_benchmark
+{
+	using namespace sakura::ecs;
+	constexpr uint32_t EntityCount = 2'000'000;
+
+	void build(world& ctx)
+	{
+		const auto placed = [&](const chunk_slice& slice, uint32_t)
+		{
+			auto translations = init_component<Translation>(ctx, slice);
+			auto l2ws = init_component<LocalToWorld>(ctx, slice);
+			forloop(i, 0u, slice.count)
+			{
+				translations[i] = sakura::Vector3f(std::array<float, 3>{ float(slice.start + i), 0.f, 0.f });
+				l2ws[i] = float4x4();
+			}
+		};
+		const auto transformed = [&](const chunk_slice& slice, uint32_t index)
+		{
+			placed(slice, index);
+			auto rotations = init_component<Rotation>(ctx, slice);
+			auto scales = init_component<Scale>(ctx, slice);
+			forloop(i, 0u, slice.count)
+			{
+				rotations[i] = sakura::Quaternion::identity();
+				scales[i] = sakura::Vector3f::vector_one();
+			}
+		};
+		task_system::ecs::spawn(ctx, entity_type{ complist<Translation, Rotation, Scale, LocalToWorld> }, EntityCount / 4 * 3, transformed);
+		task_system::ecs::spawn(ctx, entity_type{ complist<Translation, LocalToWorld> }, EntityCount / 4, placed);
+	}
+
+	void run()
+	{
+		using clock = std::chrono::steady_clock;
+		using ms = std::chrono::duration<double, std::milli>;
+		const sakura::vfs::path path(u8"ECSBenchmark.snapshot", u8"Project:");
+		task_system::ecs::snapshot_stats saved, loaded;
+		{
+			auto ctx = std::make_unique<world>();
+			build(*ctx);
+			const auto start = clock::now();
+			if (!task_system::ecs::save_snapshot<Translation, Rotation, Scale, LocalToWorld>(*ctx, path, &saved))
+				return;
+			std::cout << "Snapshot save: " << saved.entities << " entities in " << saved.groups << " groups, "
+				<< saved.bytes / (1024 * 1024) << " MB, " << ms(clock::now() - start).count() << " ms" << std::endl;
+		}
+		auto ctx = std::make_unique<world>();
+		const auto start = clock::now();
+		if (!task_system::ecs::load_snapshot<Translation, Rotation, Scale, LocalToWorld>(*ctx, path, &loaded))
+			return;
+		std::cout << "Snapshot load: " << loaded.entities << " entities, " << ms(clock::now() - start).count()
+			<< " ms" << std::endl;
+	}
+}
+
+// Recomputing LocalToWorld of the entities whose Translation changed, for 1% and
+// 10% of 1M entities changed per frame: a watched pass processes every entity of
+// the chunks holding a change, a change_queue only the changed entities, either
+// looked up one by one or resolved in one batch and visited chunk by chunk.
+namespace change_queue_benchmark
+{
+	using namespace sakura::ecs;
+	constexpr uint32_t EntityCount = 1'000'000;
+	constexpr uint32_t MeasuredFrames = 20;
+
+	sakura::vector<entity> build(world& ctx)
+	{
+		sakura::vector<entity> ents;
+		ents.reserve(EntityCount);
+		const auto slices = task_system::ecs::spawn(ctx, entity_type{ complist<Translation, LocalToWorld> }, EntityCount,
+			[&](const chunk_slice& slice, uint32_t)
+			{
+				auto translations = init_component<Translation>(ctx, slice);
+				auto l2ws = init_component<LocalToWorld>(ctx, slice);
+				forloop(i, 0u, slice.count)
+				{
+					translations[i] = sakura::Vector3f::vector_zero();
+					l2ws[i] = float4x4();
+				}
+			});
+		for (const auto& slice : slices)
+		{
+			const entity* es = ctx.get_entities(slice.c);
+			ents.insert(ents.end(), es + slice.start, es + slice.start + slice.count);
+		}
+		return ents;
+	}
+
+	float4x4 transform_of(const sakura::Vector3f& translation)
+	{
+		return sakura::math::make_transform(translation);
+	}
+
+	// The same random entities every run, so both variants see the same changes.
+	template<class F>
+	void change(const sakura::vector<entity>& ents, uint32_t count, uint32_t frame, F&& write)
+	{
+		std::mt19937 random(frame);
+		std::uniform_int_distribution<uint32_t> pick(0, (uint32_t)ents.size() - 1);
+		forloop(i, 0u, count)
+			write(ents[pick(random)], sakura::Vector3f(std::array<float, 3>{ float(frame), float(i), 0.f }));
+	}
+
+	struct result
+	{
+		double ms;
+		uint64_t entities;
+	};
+
+	result measure_chunk_filter(world& ctx, const sakura::vector<entity>& ents, uint32_t count)
+	{
+		task_system::ecs::compiled_pipeline frame(ctx, [&](task_system::ecs::pipeline& ppl)
+		{
+			def paramList = boost::hana::make_tuple(param<const Translation>, param<LocalToWorld>);
+			auto transformPass = ppl.create_pass(filters{}, paramList);
+			ppl.watch_changes(*transformPass);
+			task_system::ecs::schedule(ppl, *transformPass,
+				[](const task_system::ecs::pipeline& pipeline, const pass& pass, const task& tk)
+				{
+					auto o = operation{ paramList, pass, tk };
+					const auto translations = o.get_parameter<const Translation>();
+					auto l2ws = o.get_parameter<LocalToWorld>();
+					forloop(i, 0u, o.get_count())
+						l2ws[i] = transform_of(translations[i]);
+				});
+		});
+		// The first run processes every chunk.
+		frame.run();
+		frame.wait();
+		std::chrono::duration<double, std::milli> elapsed{};
+		uint64_t entities = 0;
+		forloop(f, 0u, MeasuredFrames)
+		{
+			// get_owned_rw stamps the chunk as changed.
+			change(ents, count, f, [&](entity e, const sakura::Vector3f& value)
+			{
+				*(value_type_t<Translation>)ctx.get_owned_rw(e, cid<Translation>) = value;
+			});
+			const auto start = std::chrono::steady_clock::now();
+			frame.run();
+			frame.wait();
+			elapsed += std::chrono::steady_clock::now() - start;
+			entities += frame.get().changes().processedEntities;
+		}
+		return { elapsed.count() / MeasuredFrames, entities / MeasuredFrames };
+	}
+
+	result measure_change_queue(world& ctx, const sakura::vector<entity>& ents, uint32_t count)
+	{
+		task_system::ecs::change_queue queue(cid<Translation>);
+		std::chrono::duration<double, std::milli> elapsed{};
+		uint64_t entities = 0;
+		forloop(f, 0u, MeasuredFrames)
+		{
+			change(ents, count, f, [&](entity e, const sakura::Vector3f& value)
+			{
+				*(value_type_t<Translation>)queue.get_owned_rw(ctx, e) = value;
+			});
+			const auto start = std::chrono::steady_clock::now();
+			std::atomic<uint64_t> processed = 0;
+			task_system::ecs::for_each_changed(queue, [&](entity e)
+			{
+				const auto translation = (const sakura::Vector3f*)ctx.get_owned_ro(e, cid<Translation>);
+				*(value_type_t<LocalToWorld>)ctx.get_owned_rw(e, cid<LocalToWorld>) = transform_of(*translation);
+				processed.fetch_add(1, std::memory_order_relaxed);
+			});
+			queue.clear();
+			elapsed += std::chrono::steady_clock::now() - start;
+			entities += processed.load();
+		}
+		return { elapsed.count() / MeasuredFrames, entities / MeasuredFrames };
+	}
+
+	result measure_batched_lookup(world& ctx, const sakura::vector<entity>& ents, uint32_t count)
+	{
+		using translation_t = std::remove_pointer_t<value_type_t<Translation>>;
+		using l2w_t = std::remove_pointer_t<value_type_t<LocalToWorld>>;
+		task_system::ecs::change_queue queue(cid<Translation>);
+		task_system::ecs::entity_lookup lookup;
+		sakura::vector<translation_t> translations;
+		std::chrono::duration<double, std::milli> elapsed{};
+		uint64_t entities = 0;
+		forloop(f, 0u, MeasuredFrames)
+		{
+			change(ents, count, f, [&](entity e, const sakura::Vector3f& value)
+			{
+				*(value_type_t<Translation>)queue.get_owned_rw(ctx, e) = value;
+			});
+			const auto start = std::chrono::steady_clock::now();
+			lookup.resolve(ctx, queue.collect());
+			translations.resize(lookup.size());
+			task_system::ecs::for_each_ro<translation_t>(ctx, lookup, cid<Translation>,
+				[&](const task_system::ecs::entity_lookup::location& l, const translation_t* translation)
+				{
+					translations[l.order] = *translation;
+				});
+			task_system::ecs::for_each_rw<l2w_t>(ctx, lookup, cid<LocalToWorld>,
+				[&](const task_system::ecs::entity_lookup::location& l, l2w_t* l2w)
+				{
+					*l2w = transform_of(translations[l.order]);
+				});
+			queue.clear();
+			elapsed += std::chrono::steady_clock::now() - start;
+			entities += lookup.size();
+		}
+		return { elapsed.count() / MeasuredFrames, entities / MeasuredFrames };
+	}
+
+	void run()
+	{
+		auto ctx = std::make_unique<world>();
+		const auto ents = build(*ctx);
+		for (const double rate : { 0.01, 0.1 })
+		{
+			const auto count = uint32_t(EntityCount * rate);
+			const auto chunks = measure_chunk_filter(*ctx, ents, count);
+			const auto queued = measure_change_queue(*ctx, ents, count);
+			const auto batched = measure_batched_lookup(*ctx, ents, count);
+			std::cout << "Change tracking " << rate * 100 << "% changed: chunk filter " << chunks.ms << " ms ("
+				<< chunks.entities << " entities), change queue " << queued.ms << " ms (" << queued.entities
+				<< " entities, " << chunks.ms / queued.ms << "x), batched lookups on one thread " << batched.ms
+				<< " ms (" << batched.entities << " entities)" << std::endl;
+		}
+	}
+}
+
+int main()
+{
+	if (!IModule::Registry::regist("ECS", &ECSModule::create) || !sakura::IModule::StartUp("ECS"))
+	{
+		sakura::error("Failed to StartUp ECSModule!");
+		return -1;
+	}
+
+	using namespace sakura::ecs;
+	cid<LocalToWorld> = register_component<LocalToWorld>();
+	cid<LocalToParent> = register_component<LocalToParent>();
+	cid<Child> = register_component<Child>();
+	cid<Parent> = register_component<Parent>();
+	cid<Translation> = register_component<Translation>();
+	cid<Rotation> = register_component<Rotation>();
+	cid<Scale> = register_component<Scale>();
+	// Snapshots go through the project directory of the VFS.
+	sakura::Core::initialize(sakura::Core::Parameters());
+
+	task_system::Scheduler scheduler(task_system::Scheduler::Config::allCores());
+	scheduler.bind();
+	defer(scheduler.unbind());
+
+	if (!hierarchy_benchmark::run())
+	{
+		sakura::error("Deferred random writes differ from the serial hierarchy walk!");
+		return -1;
+	}
+	snapshot_benchmark::run();
+	change_queue_benchmark::run();
+	return 0;
+}
@@ -0,0 +1,425 @@
+#include "TransformComponents.h"
+#include "ECS/Spawn.h"
+#include "TaskSystem/TaskSystem.h"
+#include "RuntimeCore/RuntimeCore.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <tuple>
+
+#define forloop(i, z, n) for(auto i = std::decay_t<decltype(n)>(z); i<(n); ++i)
+#define def static constexpr auto
+
+namespace task_system = sakura::task_system;
+namespace math = sakura::math;
+using float4x4 = sakura::float4x4;
+using IModule = sakura::IModule;
+
+// Headless microbenchmarks of the ECS hot paths. Data comes from fixed seeds, so
+// runs on one machine are comparable. The results are printed as one JSON document,
+// and written to the file given as first argument, for CI to diff against a baseline:
+// { "benchmarks": [ { "name": "...", "count": 1000, "unit": "ns/entity", "value": 1.5 }, ... ] }
+// Every value is the median of the measured runs.
+
+// Plain components for the iteration benchmarks.
+struct Value0
+{
+	using value_type = float;
+	static constexpr auto guid = "5D54E3D0-5DE9-4BB0-892C-B70E4A0ACEFE"_guid;
+	float value;
+};
+
+struct Value1
+{
+	using value_type = float;
+	static constexpr auto guid = "15AD2E8C-8663-40C7-9506-E00C5BE5734A"_guid;
+	float value;
+};
+
+struct Value2
+{
+	using value_type = float;
+	static constexpr auto guid = "E486EB7C-5B03-4F5C-83BA-D1355B8723DA"_guid;
+	float value;
+};
+
+struct Value3
+{
+	using value_type = float;
+	static constexpr auto guid = "9F70DC30-6553-4CEF-8C6F-A3CF61438EB5"_guid;
+	float value;
+};
+
+struct Value4
+{
+	using value_type = float;
+	static constexpr auto guid = "C21763A9-C106-4C09-AF14-1FD114E50B6E"_guid;
+	float value;
+};
+
+struct Value5
+{
+	using value_type = float;
+	static constexpr auto guid = "5EFB6779-12AA-434F-B76B-19C5F8921BE1"_guid;
+	float value;
+};
+
+struct Value6
+{
+	using value_type = float;
+	static constexpr auto guid = "D0270FFF-0C3B-4DC3-B574-69FE5FD09110"_guid;
+	float value;
+};
+
+struct Value7
+{
+	using value_type = float;
+	static constexpr auto guid = "CCFB36E7-54FF-4546-A107-299CA10EB217"_guid;
+	float value;
+};
+
+namespace bench
+{
+	constexpr uint32_t WarmupRuns = 2;
+	constexpr uint32_t MeasuredRuns = 11;
+	constexpr uint32_t Seed = 0x5EED;
+
+	struct result
+	{
+		std::string name;
+		uint64_t count;
+		const char* unit;
+		double value;
+	};
+	sakura::vector<result> results;
+
+	// Median nanoseconds of body, setup runs untimed before every run.
+	template<class Setup, class Body>
+	double median_ns(Setup&& setup, Body&& body)
+	{
+		sakura::vector<double> samples;
+		forloop(i, 0u, WarmupRuns + MeasuredRuns)
+		{
+			setup();
+			const auto start = std::chrono::steady_clock::now();
+			body();
+			const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+			if (i >= WarmupRuns)
+				samples.push_back(elapsed.count());
+		}
+		std::sort(samples.begin(), samples.end());
+		return samples[samples.size() / 2];
+	}
+
+	template<class Body>
+	double median_ns(Body&& body)
+	{
+		return median_ns([] {}, std::forward<Body>(body));
+	}
+
+	void report(std::string name, uint64_t count, const char* unit, double value)
+	{
+		std::cerr << name << ": " << value << " " << unit << std::endl;
+		results.push_back({ std::move(name), count, unit, value });
+	}
+
+	void write_json(std::ostream& out)
+	{
+		out << "{\n  \"benchmarks\": [\n";
+		forloop(i, 0u, results.size())
+		{
+			const auto& r = results[i];
+			out << "    { \"name\": \"" << r.name << "\", \"count\": " << r.count << ", \"unit\": \"" << r.unit
+				<< "\", \"value\": " << r.value << " }" << (i + 1 < results.size() ? ",\n" : "\n");
+		}
+		out << "  ]\n}\n";
+	}
+}
+
+using namespace sakura::ecs;
+
+// Linear iteration over 1M entities owning Value0..Value7: Value0 is written from
+// the sum of the other components the pass reads.
+namespace iteration_benchmark
+{
+	constexpr uint32_t EntityCount = 1'000'000;
+
+	template<class... Reads>
+	void sum_system(task_system::ecs::pipeline& ppl)
+	{
+		filters filter;
+		filter.archetypeFilter = {
+			{complist<Value0, Reads...>}
+		};
+		def paramList = boost::hana::make_tuple(param<Value0>, param<const Reads>...);
+		task_system::ecs::schedule(ppl, *ppl.create_pass(filter, paramList),
+			[](const task_system::ecs::pipeline& pipeline, const pass& pass, const task& tk)
+			{
+				auto o = operation{ paramList, pass, tk };
+				auto outs = o.template get_parameter<Value0>();
+				const auto ins = std::make_tuple(o.template get_parameter<const Reads>()...);
+				forloop(i, 0u, o.get_count())
+					outs[i] = std::apply([i](auto... in) { return (1.f + ... + in[i]); }, ins);
+			});
+	}
+
+	template<class... Reads>
+	void measure(world& ctx, const char* name)
+	{
+		task_system::ecs::compiled_pipeline frame(ctx, [](task_system::ecs::pipeline& ppl) { sum_system<Reads...>(ppl); });
+		const double ns = bench::median_ns([&]
+		{
+			frame.run();
+			frame.wait();
+		});
+		bench::report(name, EntityCount, "ns/entity", ns / EntityCount);
+	}
+
+	void run()
+	{
+		auto ctx = std::make_unique<world>();
+		std::mt19937 random(bench::Seed);
+		std::uniform_real_distribution<float> values(0.f, 1.f);
+		for (auto slice : ctx->allocate(entity_type{ complist<Value0, Value1, Value2, Value3, Value4, Value5, Value6, Value7> }, EntityCount))
+		{
+			const auto fill = [&](auto* column)
+			{
+				forloop(i, 0u, slice.count)
+					column[i] = values(random);
+			};
+			fill(init_component<Value0>(*ctx, slice));
+			fill(init_component<Value1>(*ctx, slice));
+			fill(init_component<Value2>(*ctx, slice));
+			fill(init_component<Value3>(*ctx, slice));
+			fill(init_component<Value4>(*ctx, slice));
+			fill(init_component<Value5>(*ctx, slice));
+			fill(init_component<Value6>(*ctx, slice));
+			fill(init_component<Value7>(*ctx, slice));
+		}
+		measure<>(*ctx, "iterate/1 component");
+		measure<Value1, Value2, Value3>(*ctx, "iterate/4 components");
+		measure<Value1, Value2, Value3, Value4, Value5, Value6, Value7>(*ctx, "iterate/8 components");
+	}
+}
+
+// LocalToWorld from Translation, Rotation and Scale, then WorldToLocal from LocalToWorld.
+namespace transform_benchmark
+{
+	void local_to_world_system(task_system::ecs::pipeline& ppl)
+	{
+		filters filter;
+		filter.archetypeFilter = {
+			{complist<LocalToWorld, Translation, Rotation, Scale>}
+		};
+		def paramList = boost::hana::make_tuple(param<LocalToWorld>, param<const Translation>, param<const Rotation>, param<const Scale>);
+		task_system::ecs::schedule(ppl, *ppl.create_pass(filter, paramList),
+			[](const task_system::ecs::pipeline& pipeline, const pass& pass, const task& tk)
+			{
+				auto o = operation{ paramList, pass, tk };
+				auto l2ws = o.get_parameter<LocalToWorld>();
+				const auto translations = o.get_parameter<const Translation>();
+				const auto rotations = o.get_parameter<const Rotation>();
+				const auto scales = o.get_parameter<const Scale>();
+				forloop(i, 0u, o.get_count())
+					l2ws[i] = math::make_transform(translations[i], scales[i], rotations[i]);
+			});
+	}
+
+	void world_to_local_system(task_system::ecs::pipeline& ppl)
+	{
+		filters filter;
+		filter.archetypeFilter = {
+			{complist<LocalToWorld, WorldToLocal>}
+		};
+		def paramList = boost::hana::make_tuple(param<const LocalToWorld>, param<WorldToLocal>);
+		task_system::ecs::schedule(ppl, *ppl.create_pass(filter, paramList),
+			[](const task_system::ecs::pipeline& pipeline, const pass& pass, const task& tk)
+			{
+				auto o = operation{ paramList, pass, tk };
+				const float4x4* l2ws = o.get_parameter<const LocalToWorld>();
+				float4x4* w2ls = o.get_parameter<WorldToLocal>();
+				math::lanes::for_each(o.get_count(), [&](uint32_t i, uint32_t n)
+				{
+					math::lanes::store_float4x4(w2ls + i, math::lanes::inverse(math::lanes::load_float4x4(l2ws + i, n)), n);
+				});
+			});
+	}
+
+	void measure(uint32_t entityCount)
+	{
+		auto ctx = std::make_unique<world>();
+		const auto seed = bench::Seed;
+		task_system::ecs::spawn(*ctx, entity_type{ complist<Translation, Rotation, Scale, LocalToWorld, WorldToLocal> }, entityCount,
+			[&](const chunk_slice& slice, uint32_t index)
+			{
+				std::mt19937 random(seed + index);
+				std::uniform_real_distribution<float> values(-100.f, 100.f);
+				auto translations = init_component<Translation>(*ctx, slice);
+				auto rotations = init_component<Rotation>(*ctx, slice);
+				auto scales = init_component<Scale>(*ctx, slice);
+				forloop(i, 0u, slice.count)
+				{
+					translations[i] = sakura::Vector3f(std::array<float, 3>{ values(random), values(random), values(random) });
+					rotations[i] = sakura::Quaternion::identity();
+					scales[i] = sakura::Vector3f::vector_one();
+				}
+			});
+		task_system::ecs::compiled_pipeline frame(*ctx, [](task_system::ecs::pipeline& ppl)
+		{
+			ppl.on_sync = [&ppl](gsl::span<custom_pass*> dependencies)
+			{
+				for (auto dp : dependencies)
+					ppl.pass_events[dp->passIndex].wait();
+			};
+			local_to_world_system(ppl);
+			world_to_local_system(ppl);
+		});
+		const double ns = bench::median_ns([&]
+		{
+			frame.run();
+			frame.wait();
+		});
+		bench::report("transform/" + std::to_string(entityCount), entityCount, "ns/entity", ns / entityCount);
+	}
+
+	void run()
+	{
+		for (const uint32_t entityCount : { 10'000u, 100'000u, 2'000'000u })
+			measure(entityCount);
+	}
+}
+
+// Structural changes: allocating 1M entities into an empty world, then casting all
+// of them to a type with one more component, chunk by chunk.
+namespace structural_benchmark
+{
+	constexpr uint32_t EntityCount = 1'000'000;
+
+	void run()
+	{
+		const entity_type type{ complist<Value0, Value1> };
+		const entity_type extended{ complist<Value2> };
+		std::unique_ptr<world> ctx;
+		const double allocateNs = bench::median_ns([&] { ctx = std::make_unique<world>(); }, [&]
+		{
+			for (auto slice : ctx->allocate(type, EntityCount))
+				(void)slice;
+		});
+		bench::report("structural/allocate", EntityCount, "ns/entity", allocateNs / EntityCount);
+
+		sakura::vector<chunk_slice> slices;
+		const double castNs = bench::median_ns([&]
+		{
+			ctx = std::make_unique<world>();
+			slices.clear();
+			for (auto slice : ctx->allocate(type, EntityCount))
+				slices.push_back(slice);
+		}, [&]
+		{
+			// Fresh chunks hold one slice each, casting one never moves the entities of another.
+			for (const auto& slice : slices)
+				ctx->cast(slice, type_diff{ extended, entity_type{} });
+		});
+		bench::report("structural/cast", EntityCount, "ns/entity", castNs / EntityCount);
+	}
+}
+
+// Pipeline overhead with empty kernels: a chain of passes alternating between
+// writing Value0 and Value1 over 1000 entities, recorded every frame and replayed
+// from a compiled pipeline.
+namespace schedule_benchmark
+{
+	constexpr uint32_t EntityCount = 1'000;
+	constexpr uint32_t PassCount = 64;
+
+	void record(task_system::ecs::pipeline& ppl)
+	{
+		filters filter;
+		filter.archetypeFilter = {
+			{complist<Value0, Value1>}
+		};
+		def writeFirst = boost::hana::make_tuple(param<Value0>, param<const Value1>);
+		def writeSecond = boost::hana::make_tuple(param<const Value0>, param<Value1>);
+		const auto empty = [](const task_system::ecs::pipeline&, const pass&, const task&) {};
+		forloop(i, 0u, PassCount)
+		{
+			if (i % 2 == 0)
+				task_system::ecs::schedule(ppl, *ppl.create_pass(filter, writeFirst), empty);
+			else
+				task_system::ecs::schedule(ppl, *ppl.create_pass(filter, writeSecond), empty);
+		}
+	}
+
+	void run()
+	{
+		auto ctx = std::make_unique<world>();
+		for (auto slice : ctx->allocate(entity_type{ complist<Value0, Value1> }, EntityCount))
+			(void)slice;
+		const double recordNs = bench::median_ns([&]
+		{
+			task_system::ecs::pipeline ppl(*ctx);
+			ppl.on_sync = [&ppl](gsl::span<custom_pass*> dependencies)
+			{
+				for (auto dp : dependencies)
+					ppl.pass_events[dp->passIndex].wait();
+			};
+			record(ppl);
+			ppl.wait();
+		});
+		bench::report("schedule/record", PassCount, "ns/pass", recordNs / PassCount);
+
+		task_system::ecs::compiled_pipeline frame(*ctx, [](task_system::ecs::pipeline& ppl)
+		{
+			ppl.on_sync = [&ppl](gsl::span<custom_pass*> dependencies)
+			{
+				for (auto dp : dependencies)
+					ppl.pass_events[dp->passIndex].wait();
+			};
+			record(ppl);
+		});
+		const double replayNs = bench::median_ns([&]
+		{
+			frame.run();
+			frame.wait();
+		});
+		bench::report("schedule/replay", PassCount, "ns/pass", replayNs / PassCount);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if (!IModule::Registry::regist("ECS", &ECSModule::create) || !sakura::IModule::StartUp("ECS"))
+	{
+		sakura::error("Failed to StartUp ECSModule!");
+		return -1;
+	}
+
+	register_components<Translation, Rotation, Scale, LocalToWorld, WorldToLocal,
+		Value0, Value1, Value2, Value3, Value4, Value5, Value6, Value7>();
+
+	task_system::Scheduler scheduler(task_system::Scheduler::Config::allCores());
+	scheduler.bind();
+	defer(scheduler.unbind());
+
+	iteration_benchmark::run();
+	transform_benchmark::run();
+	structural_benchmark::run();
+	schedule_benchmark::run();
+
+	bench::write_json(std::cout);
+	if (argc > 1)
+	{
+		std::ofstream file(argv[1]);
+		if (!file)
+		{
+			sakura::error("Failed to open {} for writing!", argv[1]);
+			return -1;
+		}
+		bench::write_json(file);
+	}
+	return 0;
+}
@@ -1,6 +1,13 @@
 #include "TransformComponents.h"
+#include "ECS/Access.h"
+#include "ECS/CommandBuffer.h"
+#include "ECS/Compaction.h"
+#include "ECS/Hierarchy.h"
+#include "ECS/Spawn.h"
 #include "TaskSystem/TaskSystem.h"
 #include "RuntimeCore/RuntimeCore.h"
+#include <chrono>
+#include <cstdlib>
 #include <iostream>
 
 #define forloop(i, z, n) for(auto i = std::decay_t<decltype(n)>(z); i<(n); ++i)
@@ -21,18 +28,47 @@ std::size_t calc_align(std::size_t n, std::size_t align)
 	return ((n + align - 1) / align) * align;
 }
 
+// Parameter lists of the transform systems, in schedule order.
+def RotationEulerParams = boost::hana::make_tuple(ecs::param<const RotationEuler>, ecs::param<Rotation>);
 template<class T>
-task_system::Event Local2XSystem(task_system::ecs::pipeline& ppl, ecs::filters& filter)
+def Local2XParams = boost::hana::make_tuple(
+	// write
+	ecs::param<T>,
+	// read.
+	ecs::param<const Translation>, ecs::param<const Rotation>, ecs::param<const Scale>
+);
+def Child2WorldParams = boost::hana::make_tuple(
+	// write
+	ecs::param<LocalToWorld>,
+	// read.
+	ecs::param<const LocalToParent>, ecs::param<const Parent>
+);
+def World2LocalParams = boost::hana::make_tuple(
+	// write
+	ecs::param<WorldToLocal>,
+	// read.
+	ecs::param<const LocalToWorld>
+);
+// Dependencies of the transform systems, worked out at compile time. Child2WorldSystem
+// reads root LocalToWorlds outside its own archetypes, which create_pass can not see.
+using transform_graph = task_system::ecs::system_graph<decltype(RotationEulerParams),
+	decltype(Local2XParams<LocalToWorld>), decltype(Local2XParams<LocalToParent>),
+	decltype(Child2WorldParams), decltype(World2LocalParams)>;
+static_assert(transform_graph::depends(3, 1) && transform_graph::depends(3, 2) && !transform_graph::depends(3, 0),
+	"Child2WorldSystem waits for both Local2XSystems only");
+static_assert(transform_graph::levels[1] == transform_graph::levels[2], "Local2XSystems can run side by side");
+
+template<class T>
+task_system::Event Local2XSystem(task_system::ecs::pipeline& ppl, ecs::filters& filter, const char* name)
 {
 	using namespace ecs;
-	def paramList = boost::hana::make_tuple(
-		// write
-		param<T>,
-		// read.
-		param<const Translation>, param<const Rotation>, param<const Scale>
-	);
+	def paramList = Local2XParams<T>;
+	auto pass = ppl.create_pass(filter, paramList);
+	ppl.name_pass(*pass, name);
+	ppl.allow_fusion(*pass);
+	ppl.watch_changes(*pass);
 	return task_system::ecs::schedule(ppl,
-		*ppl.create_pass(filter, paramList),
+		*pass,
 		[](const task_system::ecs::pipeline& pipeline, const ecs::pass& pass, const ecs::task& tk)
 		{
 			auto o = operation{ paramList, pass, tk };
@@ -59,10 +95,13 @@ task_system::Event RotationEulerSystem(task_system::ecs::pipeline& ppl)
 	filter.archetypeFilter = {
 		{complist<RotationEuler, Rotation>}
 	};
-	def paramList =
-		boost::hana::make_tuple(param<const RotationEuler>, param<Rotation>);
+	def paramList = RotationEulerParams;
+	auto pass = ppl.create_pass(filter, paramList);
+	ppl.name_pass(*pass, "RotationEulerSystem");
+	ppl.allow_fusion(*pass);
+	ppl.watch_changes(*pass);
 	return task_system::ecs::schedule(
-		ppl, *ppl.create_pass(filter, paramList),
+		ppl, *pass,
 		[](const task_system::ecs::pipeline& pipeline, const ecs::pass& pass, const ecs::task& tk)
 		{
 			using namespace sakura::math;
@@ -78,61 +117,24 @@ task_system::Event RotationEulerSystem(task_system::ecs::pipeline& ppl)
 		});
 }
 
-task_system::Event Child2WorldSystem(task_system::ecs::pipeline& ppl)
+// Children's LocalToWorld from their parents', one depth level at a time.
+// dependencies (pass indices) come from transform_graph, roots are written by ParentWorldSystem.
+task_system::Event Child2WorldSystem(task_system::ecs::pipeline& ppl, task_system::ecs::hierarchy_levels& hierarchy,
+	gsl::span<const uint32_t> dependencies)
 {
 	using namespace ecs;
 	filters filter;
 	filter.archetypeFilter = {
-		{complist<Child, LocalToWorld>},
-		{},
-		{complist<Parent, LocalToParent>} // from root
-	};
-	def paramList = boost::hana::make_tuple(
-		// write
-		param<LocalToWorld>,
-		// read.
-		param<const LocalToParent>, param<const Child>
-	);
-	struct children2World
-	{
-		static void solve(const float4x4& parent_l2w, const entity e)
-		{
-			float4x4 l2w = float4x4();
-			auto child_l2w = static_cast<float4x4*>(ctx.get_owned_rw(e, cid<LocalToWorld>));
-			const auto child_l2p = static_cast<const float4x4*>(ctx.get_owned_ro(e, cid<LocalToParent>));
-			if (child_l2w && child_l2p)
-			{
-				l2w = sakura::math::multiply(parent_l2w, *child_l2p);
-				*child_l2w = l2w;
-			}
-
-			index_t childSet[] = { cid<Child> };
-			if (ctx.has_component(e, childSet))
-			{
-				ecs::value_type_t<Child> child_children = ctx.get_owned_ro(e, cid<Child>);
-				for (auto& child : child_children)
-				{
-					children2World::solve(l2w, child);
-				}
-			}
-		}
+		{complist<LocalToWorld, LocalToParent, Parent>}
 	};
-	return task_system::ecs::schedule(ppl,
-		*ppl.create_pass(filter, paramList),
-		[](const task_system::ecs::pipeline& pipeline, const ecs::pass& pass, const ecs::task& tk)
+	def paramList = Child2WorldParams;
+	auto pass = ppl.create_pass(filter, paramList);
+	ppl.name_pass(*pass, "Child2WorldSystem");
+	ppl.depend_on(*pass, dependencies);
+	return task_system::ecs::schedule_custom(ppl, *pass, [&ppl, pass, &hierarchy]()
 		{
-			auto o = operation{ paramList, pass, tk };
-			const auto childrens = o.get_parameter<const Child>();
-			float4x4* l2ws = o.get_parameter<LocalToWorld>();
-
-			forloop(i, 0, o.get_count())
-			{
-				auto& children = childrens[i];
-				for (const auto& child : children)
-				{
-					children2World::solve(l2ws[i], child);
-				}
-			}
+			hierarchy.refresh(ppl, *pass);
+			hierarchy.propagate();
 		});
 }
 
@@ -145,27 +147,113 @@ task_system::Event World2LocalSystem(task_system::ecs::pipeline& ppl)
 		{}, //any
 		{} //none
 	};
-	def paramList = boost::hana::make_tuple(
-		// write
-		param<WorldToLocal>,
-		// read.
-		param<const LocalToWorld>
-	);
+	def paramList = World2LocalParams;
+	auto pass = ppl.create_pass(filter, paramList);
+	ppl.name_pass(*pass, "World2LocalSystem");
+	ppl.allow_fusion(*pass);
+	ppl.watch_changes(*pass);
 	return task_system::ecs::schedule(ppl,
-		*ppl.create_pass(filter, paramList),
+		*pass,
 		[](const task_system::ecs::pipeline& pipeline, const ecs::pass& pass, const ecs::task& tk)
 		{
 			auto o = operation{ paramList, pass, tk };
 			const float4x4* l2ws = o.get_parameter<const LocalToWorld>();
 			float4x4* w2ls = o.get_parameter<WorldToLocal>();
 
-			forloop(i, 0, o.get_count())
+			// Four matrices per step, transposed into lanes.
+			math::lanes::for_each(o.get_count(), [&](uint32_t i, uint32_t n)
 			{
-				w2ls[i] = sakura::math::inverse(l2ws[i]);
-			}
+				math::lanes::store_float4x4(w2ls + i, math::lanes::inverse(math::lanes::load_float4x4(l2ws + i, n)), n);
+			});
 		});
 }
 
+// A cast recorded for an entity that is destroyed directly before playback is
+// dropped, and does not reach the entity that reuses its id.
+bool StalePlaybackTest()
+{
+	using namespace sakura::ecs;
+	entity_type type = { complist<Translation, Scale> };
+	entity ents[2];
+	uint32_t allocated = 0;
+	for (auto c : ctx.allocate(type, 2))
+		for (uint32_t i = 0; i < c.count; ++i)
+			ents[allocated++] = ctx.get_entities(c.c)[c.start + i];
+
+	task_system::ecs::command_buffer commands(ctx);
+	index_t extend[] = { cid<Rotation> };
+	type_diff diff;
+	diff.extend = entity_type{ {extend} };
+	commands.cast(ents[0], diff);
+	commands.cast(ents[1], diff);
+	for (auto c : ctx.batch(ents, 1))
+		ctx.destroy(c);
+	entity reused;
+	for (auto c : ctx.allocate(type, 1))
+		reused = ctx.get_entities(c.c)[c.start];
+	commands.playback();
+
+	const bool passed = commands.last_playback().dropped == 1 &&
+		ctx.get_owned_ro(ents[1], cid<Rotation>) != nullptr && ctx.get_owned_ro(reused, cid<Rotation>) == nullptr;
+	if (!passed)
+		sakura::error("command_buffer: a cast of a destroyed entity was played back!");
+	const entity remaining[] = { ents[1], reused };
+	for (auto c : ctx.batch(remaining, 2))
+		ctx.destroy(c);
+	return passed;
+}
+
+// Chunks left sparse by destroys are packed by compaction_job: the archetype ends up
+// with no chunk to spare and the moved entities keep their handles and values.
+bool CompactionTest()
+{
+	using namespace sakura::ecs;
+	entity_type type = { complist<Translation, WorldToLocal> };
+	sakura::vector<entity> ents, destroyed;
+	sakura::vector<float> values;
+	const archetype* packed = nullptr;
+	uint32_t chunkIndex = 0;
+	for (auto c : ctx.allocate(type, 4096))
+	{
+		packed = c.c->type;
+		const entity* chunkEnts = ctx.get_entities(c.c) + c.start;
+		auto translations = init_component<Translation>(ctx, c);
+		// Every other chunk keeps a quarter of its entities.
+		for (uint32_t i = 0; i < c.count; ++i)
+		{
+			const float value = (float)(ents.size() + destroyed.size());
+			translations[i] = Vector3f(std::array<float, 3>{ value, 0.f, 0.f });
+			if (chunkIndex % 2 == 1 && i < c.count * 3 / 4)
+				destroyed.push_back(chunkEnts[i]);
+			else
+			{
+				ents.push_back(chunkEnts[i]);
+				values.push_back(value);
+			}
+		}
+		chunkIndex++;
+	}
+	for (auto c : ctx.batch(destroyed.data(), (uint32_t)destroyed.size()))
+		ctx.destroy(c);
+
+	task_system::ecs::compaction_job compaction(ctx);
+	for (int steps = 0; steps < 64 && compaction.step(~0ull); ++steps) {}
+	bool passed = compaction.total().chunksEmptied > 0;
+	for (const auto& f : task_system::ecs::measure_fragmentation(ctx))
+		if (f.type == packed)
+			passed &= f.sparse_chunks() == 0;
+	for (size_t i = 0; i < ents.size() && passed; ++i)
+	{
+		passed = ctx.exist(ents[i]);
+		const auto translation = passed ? static_cast<const Vector3f*>(ctx.get_owned_ro(ents[i], cid<Translation>)) : nullptr;
+		passed = translation && translation->data_view()[0] == values[i];
+	}
+	if (!passed)
+		sakura::error("compaction_job: sparse chunks were left or moved entities changed!");
+	for (auto c : ctx.batch(ents.data(), (uint32_t)ents.size()))
+		ctx.destroy(c);
+	return passed;
+}
 
 int main()
 {
@@ -187,77 +275,116 @@ int main()
 	cid<Child> = register_component<Child>();
 	cid<Parent> = register_component<Parent>();
 
+	// Bound first so that spawning initializes chunks on every core.
+	task_system::Scheduler scheduler(task_system::Scheduler::Config::allCores());
+	scheduler.bind();
+	defer(scheduler.unbind());  // Automatically unbind before returning.
+
+	if (!StalePlaybackTest() || !CompactionTest())
+		return -1;
+
 	entity_type type = {
 		complist<Translation, RotationEuler, Rotation, Scale, LocalToWorld, WorldToLocal> };
 	{
-		for (auto c : ctx.allocate(type, 2000000))
+		// Every entity starts as a copy of this one.
+		entity prefab;
+		for (auto c : ctx.allocate(type, 1))
 		{
-			RotationEuler::value_type* rotators = init_component<RotationEuler>(ctx, c);
-			Scale::value_type* scales = init_component<Scale>(ctx, c);
-			Translation::value_type* translations = init_component<Translation>(ctx, c);
-			auto l2ws = init_component<LocalToWorld>(ctx, c);
-			const entity* ents = ctx.get_entities(c.c);
-			auto ent_p = ents[0];
-			auto ent_c = ents[c.count - 1];
-
-			forloop(i, 0, c.count)
-			{
-				rotators[i] = Rotator{ 0.f, 0.f, 0.f };
-				scales[i] = Vector3f::vector_one();
-				translations[i] = Vector3f(std::array<float, 3>{1.f, 2.f, 3.f});
-				l2ws[i] = float4x4();
-			}
-
-			forloop(i, 0, c.count)
+			*init_component<RotationEuler>(ctx, c) = Rotator{ 0.f, 0.f, 0.f };
+			*init_component<Scale>(ctx, c) = Vector3f::vector_one();
+			*init_component<Translation>(ctx, c) = Vector3f(std::array<float, 3>{1.f, 2.f, 3.f});
+			*init_component<LocalToWorld>(ctx, c) = float4x4();
+			prefab = ctx.get_entities(c.c)[c.start];
+		}
+		// Hierarchy links are cast through a command buffer and applied chunk by chunk.
+		task_system::ecs::command_buffer commands(ctx);
+		index_t parentExtend[] = { cid<Child> };
+		type_diff parentDiff;
+		parentDiff.extend = entity_type{ {parentExtend} };
+		index_t childExtend[] = { cid<Parent>, cid<LocalToParent> };
+		type_diff childDiff;
+		childDiff.extend = entity_type{ {childExtend} };
+		sakura::vector<std::pair<entity, entity>> links;
+		const auto start = std::chrono::steady_clock::now();
+		auto slices = task_system::ecs::spawn_clones<RotationEuler, Scale, Translation, LocalToWorld>(ctx, prefab, 2000000,
+			[&](const chunk_slice& c, uint32_t)
 			{
-				chunk_slice cs;
-				cs.c = c.c;
-				cs.count = 1;
-				cs.start = c.start;
-				if (i == 0)
-				{
-					type_diff diff;
-					index_t extend[] = { cid<Child> };
-					diff.extend = entity_type{ {extend} };
-					ctx.cast(cs, diff);
-
-					auto p = (value_type_t<Child>)ctx.get_owned_rw(ent_p, cid<Child>);
-					p.push(ent_c);
-				}
-				else if (i == 1)
-				{
-					type_diff diff;
-					index_t extend[] = { cid<Parent>, cid<LocalToParent> };
-					diff.extend = entity_type{ {extend} };
-					ctx.cast(cs, diff);
-
-					auto p = (value_type_t<Parent>)ctx.get_owned_rw(ent_c, cid<Parent>);
-					auto l2p = (value_type_t<LocalToParent>)ctx.get_owned_rw(ent_c, cid<LocalToParent>);
-					auto l2w = (value_type_t<LocalToWorld>)ctx.get_owned_rw(ent_c, cid<LocalToWorld>);
-					*l2w = float4x4();
-					*l2p = float4x4();
-					*p = ent_p;
-				}
-			}
+				const entity* ents = ctx.get_entities(c.c);
+				commands.cast(ents[c.start], parentDiff);
+				commands.cast(ents[c.start + c.count - 1], childDiff);
+			});
+		std::cout << "Spawned 2000000 entities in " << std::chrono::duration<double, std::milli>(
+			std::chrono::steady_clock::now() - start).count() << " ms." << std::endl;
+		// Every other chunk also loses half of its unlinked entities, which leaves the
+		// archetype sparse enough for the compaction job below.
+		sakura::vector<entity> churn;
+		for (size_t i = 0; i < slices.size(); ++i)
+		{
+			const auto& c = slices[i];
+			const entity* ents = ctx.get_entities(c.c);
+			links.emplace_back(ents[c.start], ents[c.start + c.count - 1]);
+			if (i % 2 == 1)
+				churn.insert(churn.end(), ents + c.start + 1, ents + c.start + c.count / 2);
 		}
-	}
-
-	task_system::Scheduler scheduler(task_system::Scheduler::Config::allCores());
-	scheduler.bind();
-	defer(scheduler.unbind());  // Automatically unbind before returning.
-
+		for (auto c : ctx.batch(&prefab, 1))
+			ctx.destroy(c);
+		commands.playback();
+		std::cout << commands.last_playback().commands << " casts applied in "
+			<< commands.last_playback().bulkOperations << " chunk operations." << std::endl;
 
+		for (auto [ent_p, ent_c] : links)
+		{
+			auto children = (value_type_t<Child>)ctx.get_owned_rw(ent_p, cid<Child>);
+			children.push(ent_c);
+
+			auto p = (value_type_t<Parent>)ctx.get_owned_rw(ent_c, cid<Parent>);
+			auto l2p = (value_type_t<LocalToParent>)ctx.get_owned_rw(ent_c, cid<LocalToParent>);
+			auto l2w = (value_type_t<LocalToWorld>)ctx.get_owned_rw(ent_c, cid<LocalToWorld>);
+			*l2w = float4x4();
+			*l2p = float4x4();
+			*p = ent_p;
+		}
 
+		for (auto e : churn)
+			commands.destroy(e);
+		commands.playback();
+		std::cout << churn.size() << " entities destroyed in "
+			<< commands.last_playback().bulkOperations << " chunk operations." << std::endl;
+	}
 
-	while (1)
+	// The churn above left every other chunk half empty, compacted a slice per frame.
+	task_system::ecs::compaction_job compaction(ctx);
+	constexpr uint64_t compactionBudgetNs = 500000;
+	bool compacting = true;
+	const auto print_fragmentation = []
+	{
+		for (const auto& f : task_system::ecs::measure_fragmentation(ctx))
+			std::cout << "Archetype: " << f.entities << " entities in " << f.chunks << " chunks, occupancy "
+				<< f.occupancy() << ", " << f.sparse_chunks() << " sparse chunks." << std::endl;
+	};
+	print_fragmentation();
+
+	task_system::ecs::adaptive_schedule adaptive;
+	// SAKURA_PIPELINE_TRACE=<path> dumps a Chrome trace of one frame after warm-up,
+	// then exits so that the trace file is complete when the process returns.
+	const char* tracePath = std::getenv("SAKURA_PIPELINE_TRACE");
+	task_system::ecs::pipeline_timeline timeline;
+	constexpr uint32_t traceFrame = 16;
+	uint32_t frameIndex = 0;
+	task_system::Event rotationEulerSystem, parentWorldSystem, child2ParentSystem, child2WorldSystem, world2LocalSystem;
+	task_system::ecs::hierarchy_levels hierarchy(cid<Parent>, cid<LocalToWorld>, cid<LocalToParent>);
+	task_system::ecs::compiled_pipeline transform_pipeline(ctx, [&](task_system::ecs::pipeline& ppl)
 	{
-		task_system::ecs::pipeline transform_pipeline(ctx);
-		transform_pipeline.on_sync = [&](gsl::span<custom_pass*> dependencies)
+		ppl.adaptive = &adaptive;
+		ppl.on_sync = [&ppl](gsl::span<custom_pass*> dependencies)
 		{
 			for (auto dp : dependencies)
-				transform_pipeline.pass_events[dp->passIndex].wait();
+				ppl.pass_events[dp->passIndex].wait();
 		};
-		auto rotationEulerSystem = RotationEulerSystem(transform_pipeline);
+		// Pass index of the system scheduled last.
+		auto last_pass = [&ppl] { return (uint32_t)ppl.pass_infos.size() - 1; };
+		rotationEulerSystem = RotationEulerSystem(ppl);
+		const uint32_t rotationEulerPass = last_pass();
 
 		filters wrd_filter;
 		wrd_filter.archetypeFilter = {
@@ -265,7 +392,8 @@ int main()
 			{complist<Translation, Scale, Rotation>},
 			{complist<LocalToParent, Parent>}
 		};
-		auto parentWorldSystem = Local2XSystem<LocalToWorld>(transform_pipeline, wrd_filter);
+		parentWorldSystem = Local2XSystem<LocalToWorld>(ppl, wrd_filter, "ParentWorldSystem");
+		const uint32_t parentWorldPass = last_pass();
 
 		filters c2p_filter;
 		c2p_filter.archetypeFilter = {
@@ -273,11 +401,23 @@ int main()
 			{complist<Translation, Scale, Rotation>},
 			{}
 		};
-		auto child2ParentSystem = Local2XSystem<LocalToParent>(transform_pipeline, c2p_filter);
-
-		auto child2WorldSystem = Child2WorldSystem(transform_pipeline);
-
-		auto world2LocalSystem = World2LocalSystem(transform_pipeline);
+		child2ParentSystem = Local2XSystem<LocalToParent>(ppl, c2p_filter, "Child2ParentSystem");
+		const uint32_t child2ParentPass = last_pass();
+
+		// Passes of the systems scheduled so far, in transform_graph order.
+		const uint32_t scheduled[] = { rotationEulerPass, parentWorldPass, child2ParentPass };
+		child2WorldSystem = Child2WorldSystem(ppl, hierarchy, transform_graph::dependency_passes(3, scheduled));
+
+		world2LocalSystem = World2LocalSystem(ppl);
+	});
+	if (tracePath)
+		transform_pipeline.timeline = &timeline;
+	// Unbounded unless tracing.
+	while (!tracePath || frameIndex < traceFrame)
+	{
+		transform_pipeline.run();
+		if (frameIndex == 0)
+			std::cout << "Fused passes:\n" << transform_pipeline.get().fusion_report() << std::endl;
 
 		// 等待pass
 		rotationEulerSystem.wait();
@@ -293,5 +433,28 @@ int main()
 
 		// 等待pipeline
 		transform_pipeline.wait();
+		// Every dependency is a pass of the pipeline, no pass waits on an event.
+		if (transform_pipeline.get().prologue_wait_time() != 0)
+		{
+			std::cout << "Passes waited " << transform_pipeline.get().prologue_wait_time()
+				<< "ns on external events." << std::endl;
+			return -1;
+		}
+		const auto changes = transform_pipeline.get().changes();
+		std::cout << "Processed " << changes.processedEntities << " entities in " << changes.processedChunks
+			<< " chunks, skipped " << changes.skippedEntities << " unchanged entities." << std::endl;
+		// Sync point: no pass touches the world until the next run.
+		if (compacting && !compaction.step(compactionBudgetNs))
+		{
+			compacting = false;
+			std::cout << "Compaction moved " << compaction.total().entitiesMoved << " entities out of "
+				<< compaction.total().chunksEmptied << " chunks." << std::endl;
+			print_fragmentation();
+		}
+		++frameIndex;
 	}
+	if (!timeline.dump_chrome_trace(tracePath))
+		return -1;
+	std::cout << "Pipeline trace written to " << tracePath << std::endl;
+	return 0;
 }
\ No newline at end of file
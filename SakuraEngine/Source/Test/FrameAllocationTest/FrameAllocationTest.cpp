@@ -0,0 +1,335 @@
+#include "tracy/Tracy.hpp"
+#include "TransformComponents.h"
+#include "ECS/Spawn.h"
+#include "ECS/FrameScratch.h"
+#include "ECS/RandomWrites.h"
+#include "TaskSystem/Counters.h"
+#include "TaskSystem/TaskSystem.h"
+#include "RuntimeCore/RuntimeCore.h"
+#include "Math/Random.h"
+#include "kdtree.h"
+#include "marl/memory.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#if defined(_MSC_VER) && defined(_DEBUG)
+#include <crtdbg.h>
+#endif
+
+#define forloop(i, z, n) for(auto i = std::decay_t<decltype(n)>(z); i<(n); ++i)
+#define def static constexpr auto
+
+namespace task_system = sakura::task_system;
+namespace math = sakura::math;
+using IModule = sakura::IModule;
+
+// Once warm, replaying a compiled frame must not touch the heap: scheduling, the
+// kernels, scratch arenas, pooled resources and the kd-tree build all keep their
+// storage between frames. The frame is a headless stand-in for the Boids frame
+// (copy out, kd-tree build, neighbour search with scratch buffers), Boids itself
+// needs a window and a device. It runs with the features the Boids frame turns on:
+// adaptive scheduling, a time-sliced pass, a watched pass, deferred random writes
+// and sharded counters. Left out are the hierarchy (Child buffers) and Tracy plots. A single allocation while the measured frames run,
+// on any thread, fails the test whatever the build configuration.
+//
+// Three allocation paths are counted:
+// - operator new, replaced below. Shared modules bind to it on ELF and Mach-O
+//   platforms; on MSVC every DLL keeps its own operator new, so debug builds count
+//   at the CRT heap instead through an allocation hook, which sees every module.
+// - marl::Allocator, which allocates fibers, task storage and event state straight
+//   from the OS. The default allocator is wrapped before the scheduler starts.
+// - scratch arena blocks, taken with std::malloc, through the arenas' own counter.
+// Other direct malloc calls are not seen. Tracy allocates through its own
+// allocator and is not counted either, the stand-in frame records no zones.
+namespace frame_allocations
+{
+	std::atomic<bool> counting = false;
+	std::atomic<uint64_t> count = 0;
+
+	void record() noexcept
+	{
+		if (counting.load(std::memory_order_relaxed))
+			count.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	struct counting_allocator final : marl::Allocator
+	{
+		explicit counting_allocator(marl::Allocator* inner)
+			:inner(inner) {}
+		marl::Allocation allocate(const marl::Allocation::Request& request) override
+		{
+			record();
+			return inner->allocate(request);
+		}
+		void free(const marl::Allocation& allocation) override
+		{
+			inner->free(allocation);
+		}
+		marl::Allocator* const inner;
+	};
+
+#if defined(_MSC_VER) && defined(_DEBUG)
+	// operator new ends up here as well, it must not count twice.
+	constexpr bool CountOperatorNew = false;
+
+	int crt_hook(int allocType, void*, size_t, int, long, const unsigned char*, int)
+	{
+		if (allocType != _HOOK_FREE)
+			record();
+		return TRUE;
+	}
+#else
+	constexpr bool CountOperatorNew = true;
+#endif
+
+	void* allocate(std::size_t size) noexcept
+	{
+		if (CountOperatorNew)
+			record();
+		return std::malloc(size ? size : 1);
+	}
+
+	void* allocate(std::size_t size, std::align_val_t alignment) noexcept
+	{
+		if (CountOperatorNew)
+			record();
+		const std::size_t align = (std::size_t)alignment;
+#if defined(_MSC_VER)
+		return _aligned_malloc(size ? size : 1, align);
+#else
+		// aligned_alloc wants a multiple of the alignment.
+		return std::aligned_alloc(align, ((size ? size : 1) + align - 1) / align * align);
+#endif
+	}
+
+	void free_aligned(void* ptr) noexcept
+	{
+#if defined(_MSC_VER)
+		_aligned_free(ptr);
+#else
+		std::free(ptr);
+#endif
+	}
+}
+
+void* operator new(std::size_t size)
+{
+	if (void* ptr = frame_allocations::allocate(size))
+		return ptr;
+	throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+	return frame_allocations::allocate(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+	if (void* ptr = frame_allocations::allocate(size, alignment))
+		return ptr;
+	throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	return frame_allocations::allocate(size, alignment);
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::align_val_t) noexcept { frame_allocations::free_aligned(ptr); }
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept { frame_allocations::free_aligned(ptr); }
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { frame_allocations::free_aligned(ptr); }
+
+// Points drift towards the centre of their neighbours: positions are copied out,
+// a kd-tree is rebuilt from them and searched with scratch buffers, every frame.
+namespace workload
+{
+	using namespace sakura::ecs;
+	constexpr uint32_t EntityCount = 20'000;
+	constexpr uint64_t Seed = 0x3C6EF372FE94F82Bull;
+	constexpr float Radius = 2.f;
+	constexpr int Neighbors = 8;
+
+	struct Point
+	{
+		sakura::Vector3f value;
+		Point() {}
+		Point(sakura::Vector3f value)
+			:value(value) {}
+		def dim = 3;
+		using value_type = float;
+		float operator[](size_t i) const { return value.data_view()[i]; }
+	};
+
+	// Neighbours found per point, read once per frame.
+	task_system::sharded_stat<size_t> neighborCounts;
+
+	void spawn(world& ctx)
+	{
+		auto slices = task_system::ecs::spawn_reserve(ctx, entity_type{ complist<Translation, LocalToWorld> }, EntityCount);
+		// Entities before each slice, every entity draws from its own stream.
+		sakura::vector<uint32_t> offsets(slices.size());
+		uint32_t offset = 0;
+		forloop(i, 0u, (uint32_t)slices.size())
+		{
+			offsets[i] = offset;
+			offset += slices[i].count;
+		}
+		task_system::ecs::spawn_initialize(slices,
+			[&](const chunk_slice& slice, uint32_t index)
+			{
+				auto translations = init_component<Translation>(ctx, slice);
+				forloop(i, 0u, slice.count)
+				{
+					math::random_stream random(Seed, offsets[index] + i);
+					translations[i] = sakura::Vector3f(std::array<float, 3>{
+						random.uniform(-50.f, 50.f), random.uniform(-50.f, 50.f), random.uniform(-50.f, 50.f) });
+				}
+			});
+	}
+
+	void record(world& ctx, task_system::ecs::adaptive_schedule& adaptive, task_system::ecs::pipeline& ppl)
+	{
+		ppl.adaptive = &adaptive;
+		ppl.on_sync = [&ppl](gsl::span<custom_pass*> dependencies)
+		{
+			for (auto dp : dependencies)
+				ppl.pass_events[dp->passIndex].wait();
+		};
+		filters filter;
+		filter.archetypeFilter = { {complist<Translation>} };
+		auto positions = ppl.persistent_resource<std::vector<Point>>("FrameAllocationTest.Positions");
+		auto tree = ppl.persistent_resource<core::algo::kdtree<Point>>("FrameAllocationTest.Tree");
+		{
+			def paramList = boost::hana::make_tuple(param<const Translation>);
+			shared_entry shareList[] = { write(positions) };
+			auto pass = ppl.create_pass(filter, paramList, shareList);
+			positions->resize(pass->entityCount);
+			task_system::ecs::schedule(ppl, *pass,
+				[positions](const task_system::ecs::pipeline& pipeline, const sakura::ecs::pass& pass, const task& tk) mutable
+				{
+					auto o = operation{ paramList, pass, tk };
+					auto index = o.get_index();
+					auto trs = o.get_parameter<const Translation>();
+					forloop(i, 0, o.get_count())
+						(*positions)[index + i] = trs[i];
+				});
+		}
+		{
+			shared_entry shareList[] = { read(positions), write(tree) };
+			task_system::ecs::schedule_custom(ppl, *ppl.create_custom_pass(shareList), [positions, tree]() mutable
+				{
+					tree->initialize(*positions);
+				});
+		}
+		{
+			def paramList = boost::hana::make_tuple(param<Translation>);
+			shared_entry shareList[] = { read(tree) };
+			auto pass = ppl.create_pass(filter, paramList, shareList);
+			// Half of the points move each frame, the watched pass below skips the other chunks.
+			ppl.time_slice(*pass, 2);
+			task_system::ecs::schedule(ppl, *pass,
+				[tree](const task_system::ecs::pipeline& pipeline, const sakura::ecs::pass& pass, const task& tk)
+				{
+					auto o = operation{ paramList, pass, tk };
+					auto trs = o.get_parameter<Translation>();
+					auto& scratch = pipeline.local_scratch();
+					task_system::ecs::scratch_vector<std::pair<float, int>> neighbors(scratch);
+					neighbors.reserve(Neighbors);
+					task_system::ecs::scratch_vector<sakura::Vector3f> centres(o.get_count(), scratch);
+					forloop(i, 0, o.get_count())
+					{
+						neighbors.clear();
+						tree->search_k_radius(trs[i], Radius, Neighbors, neighbors);
+						neighborCounts.record(neighbors.size());
+						centres[i] = sakura::Vector3f::vector_zero();
+						for (auto n : neighbors)
+							centres[i] = centres[i] + (*tree)[n.second].value;
+						if (!neighbors.empty())
+							centres[i] = centres[i] / (float)neighbors.size();
+						else
+							centres[i] = trs[i];
+					}
+					forloop(i, 0, o.get_count())
+						trs[i] = trs[i] + (centres[i] - trs[i]) * 0.01f;
+				}, 500);
+		}
+		{
+			// Written through deferred random writes, as Boids writes its children's transforms.
+			def paramList = boost::hana::make_tuple(param<const Translation>, param<LocalToWorld>);
+			auto pass = ppl.create_pass(filter, paramList);
+			ppl.watch_changes(*pass);
+			auto writes = ppl.persistent_resource<task_system::ecs::random_writes>("FrameAllocationTest.Writes", ctx);
+			ppl.defer_random_writes(*pass, *writes);
+			task_system::ecs::schedule(ppl, *pass,
+				[&ctx, writes](const task_system::ecs::pipeline& pipeline, const sakura::ecs::pass& pass, const task& tk)
+				{
+					auto o = operation{ paramList, pass, tk };
+					auto trs = o.get_parameter<const Translation>();
+					const entity* ents = ctx.get_entities(tk.slice.c) + tk.slice.start;
+					forloop(i, 0, o.get_count())
+						writes->write<LocalToWorld>(tk, ents[i],
+							math::make_transform(trs[i], sakura::Vector3f::vector_one(), sakura::Quaternion::identity()));
+				});
+		}
+	}
+}
+
+int main()
+{
+	if (!IModule::Registry::regist("ECS", &ECSModule::create) || !sakura::IModule::StartUp("ECS"))
+	{
+		sakura::error("Failed to StartUp ECSModule!");
+		return -1;
+	}
+	register_components<Translation, LocalToWorld>();
+
+	// Installed before anything of marl is created, every later allocation goes through it.
+	static frame_allocations::counting_allocator marlAllocator(marl::Allocator::Default);
+	marl::Allocator::Default = &marlAllocator;
+	auto config = task_system::Scheduler::Config::allCores();
+	config.setAllocator(&marlAllocator);
+	task_system::Scheduler scheduler(config);
+	scheduler.bind();
+	defer(scheduler.unbind());
+
+	sakura::ecs::world ctx;
+	workload::spawn(ctx);
+	task_system::ecs::adaptive_schedule adaptive;
+	task_system::ecs::compiled_pipeline frame(ctx, [&](task_system::ecs::pipeline& ppl) { workload::record(ctx, adaptive, ppl); });
+
+	// Recording, pooled resources, scratch blocks, kd-tree buffers and the task
+	// system's pools settle during the warm-up frames.
+	constexpr uint32_t WarmupFrames = 30;
+	constexpr uint32_t MeasuredFrames = 100;
+	forloop(i, 0u, WarmupFrames)
+	{
+		frame.run();
+		frame.wait();
+		workload::neighborCounts.collect();
+	}
+#if defined(_MSC_VER) && defined(_DEBUG)
+	_CrtSetAllocHook(&frame_allocations::crt_hook);
+#endif
+	const size_t scratchBlocks = frame.scratch.heap_allocations();
+	frame_allocations::counting.store(true);
+	forloop(i, 0u, MeasuredFrames)
+	{
+		frame.run();
+		frame.wait();
+		workload::neighborCounts.collect();
+	}
+	frame_allocations::counting.store(false);
+	const uint64_t allocations = frame_allocations::count.load() + (frame.scratch.heap_allocations() - scratchBlocks);
+	std::printf("%llu heap allocations in %u frames\n", (unsigned long long)allocations, MeasuredFrames);
+	if (allocations != 0)
+	{
+		std::printf("FAILED: the frame loop allocated after warm-up\n");
+		return -1;
+	}
+	return 0;
+}
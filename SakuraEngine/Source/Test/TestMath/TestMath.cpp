@@ -1,4 +1,149 @@
 #include "RuntimeCore/RuntimeCore.h"
+#include "Math/Random.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+// Philox4x32-10 known answers from the Random123 distribution (kat_vectors),
+// then fill_uniform against random_stream over unaligned ranges, which runs the
+// SSE2 lanes, their transpose and the scalar head and tail around them.
+static bool test_random()
+{
+	using namespace sakura::math;
+	struct known_answer
+	{
+		uint64_t key, stream, index;
+		philox::block expected;
+	};
+	const known_answer answers[] = {
+		{ 0, 0, 0, { 0x6627e8d5u, 0xe169c58du, 0xbc57ac4cu, 0x9b00dbd8u } },
+		{ ~0ull, ~0ull, ~0ull, { 0x408f276du, 0x41c83b0eu, 0xa20bc7c6u, 0x6d5451fdu } },
+		{ 0x299f31d0a4093822ull, 0x0370734413198a2eull, 0x85a308d3243f6a88ull, { 0xd16cfe09u, 0x94fdccebu, 0x5001e420u, 0x24126ea1u } },
+	};
+	bool passed = true;
+	for (const auto& answer : answers)
+	{
+		if (philox::generate(answer.key, answer.stream, answer.index) != answer.expected)
+		{
+			std::printf("philox: wrong block for key %llx\n", (unsigned long long)answer.key);
+			passed = false;
+		}
+	}
+
+	const uint64_t seed = 0x5EED5A4B75A5EEDull, stream = 42;
+	for (uint64_t first : { 0, 1, 3, 4, 5, 17 })
+	{
+		for (uint32_t count : { 1u, 3u, 15u, 16u, 17u, 37u, 64u, 100u })
+		{
+			float filled[100];
+			fill_uniform(seed, stream, first, filled, count);
+			random_stream drawn(seed, stream, first);
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				if (filled[i] != drawn.uniform())
+				{
+					std::printf("fill_uniform: sample %u of [%llu, +%u) differs from random_stream\n", i, (unsigned long long)first, count);
+					passed = false;
+					break;
+				}
+			}
+		}
+	}
+	return passed;
+}
+
+// math::lanes against the scalar functions: the float4x4 transposes and the
+// cofactor inverse, load_float3 from packed and strided arrays, store_float3 and
+// normalize, for a full group and tails of 1 to 3. Lanes past count must be
+// left untouched by the stores.
+static bool test_lanes()
+{
+	using namespace sakura;
+	using namespace sakura::math;
+	constexpr uint32_t Width = lanes::Width;
+	const auto close = [](float a, float b) { return std::abs(a - b) <= 1e-4f * std::max(1.f, std::abs(b)); };
+	constexpr float Untouched = 12345.f;
+	bool passed = true;
+
+	float4x4 matrices[Width];
+	for (uint32_t i = 0; i < Width; ++i)
+	{
+		matrices[i] = make_transform(Vector3f(1.f + i, -2.f * i, 0.5f), Vector3f(1.f + 0.5f * i, 2.f, 0.75f),
+			quaternion_from_euler(0.3f * i, 0.2f, -0.1f * i));
+		// Not affine, so that every cofactor term counts.
+		matrices[i].M[0][3] = 0.05f * (i + 1);
+	}
+	for (uint32_t count = 1; count <= Width; ++count)
+	{
+		float4x4 copied[Width], inverted[Width];
+		for (uint32_t i = 0; i < Width; ++i)
+		{
+			std::fill(copied[i].M16, copied[i].M16 + 16, Untouched);
+			std::fill(inverted[i].M16, inverted[i].M16 + 16, Untouched);
+		}
+		const auto loaded = lanes::load_float4x4(matrices, count);
+		lanes::store_float4x4(copied, loaded, count);
+		lanes::store_float4x4(inverted, lanes::inverse(loaded), count);
+		for (uint32_t i = 0; i < Width; ++i)
+		{
+			const float4x4 expected = inverse(matrices[i]);
+			for (uint32_t e = 0; e < 16; ++e)
+			{
+				const bool copyOk = i < count ? copied[i].M16[e] == matrices[i].M16[e] : copied[i].M16[e] == Untouched;
+				const bool inverseOk = i < count ? close(inverted[i].M16[e], expected.M16[e]) : inverted[i].M16[e] == Untouched;
+				if (!copyOk || !inverseOk)
+				{
+					std::printf("lanes: matrix %u of %u, element %u: %s differs\n", i, count, e, copyOk ? "inverse" : "transpose");
+					passed = false;
+					break;
+				}
+			}
+		}
+	}
+
+	// The last vector is shorter than the tolerance and normalizes to zero.
+	const Vector3f vectors[Width] = {
+		Vector3f(3.f, 4.f, 0.f), Vector3f(-1.f, 2.f, -2.f), Vector3f(0.5f, 0.25f, 8.f), Vector3f(1e-5f, 0.f, 0.f)
+	};
+	struct strided_t
+	{
+		float before;
+		Vector3f v;
+		float after[2];
+	};
+	strided_t strided[Width];
+	for (uint32_t i = 0; i < Width; ++i)
+		strided[i] = { -1.f, vectors[i], { -2.f, -3.f } };
+	for (uint32_t count = 1; count <= Width; ++count)
+	{
+		const lanes::float3_lanes packedLanes = lanes::load_float3(vectors, count);
+		const lanes::float3_lanes stridedLanes = lanes::load_float3(&strided[0].v, count, sizeof(strided_t));
+		Vector3f fromPacked[Width], fromStrided[Width], normalized[Width];
+		for (uint32_t i = 0; i < Width; ++i)
+			fromPacked[i] = fromStrided[i] = normalized[i] = Vector3f(Untouched, Untouched, Untouched);
+		lanes::store_float3(fromPacked, packedLanes, count);
+		lanes::store_float3(fromStrided, stridedLanes, count);
+		lanes::store_float3(normalized, lanes::normalize(packedLanes), count);
+		for (uint32_t i = 0; i < Width; ++i)
+		{
+			const Vector3f expected = normalize(vectors[i]);
+			for (uint32_t c = 0; c < 3; ++c)
+			{
+				const float source = i < count ? vectors[i].data_view()[c] : Untouched;
+				const bool loadOk = fromPacked[i].data_view()[c] == source && fromStrided[i].data_view()[c] == source;
+				const bool normalizeOk = i < count ? close(normalized[i].data_view()[c], expected.data_view()[c]) :
+					normalized[i].data_view()[c] == Untouched;
+				if (!loadOk || !normalizeOk)
+				{
+					std::printf("lanes: vector %u of %u, component %u: %s differs\n", i, count, c, loadOk ? "normalize" : "load/store");
+					passed = false;
+					break;
+				}
+			}
+		}
+	}
+	return passed;
+}
 
 int main(void)
 {
@@ -259,6 +404,11 @@ int main(void)
 
 	auto nt = sakura::math::normalize(Vector3f(1.f, 1.f, 1.f));
 
+	if (!test_random())
+		return 1;
+	if (!test_lanes())
+		return 1;
+
 	bool end = true;
 	if(end)
 	{